@@ -0,0 +1,45 @@
+#ifndef BENCHUTILS_H
+#define BENCHUTILS_H
+
+#include "ProgramOptions.h"
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+/**
+ * Splits a comma separated list of values
+ */
+template<typename T>
+std::vector<T> parseList(const std::string& list)
+{
+  std::vector<T> values;
+  std::stringstream ss(list);
+  std::string token;
+  while(std::getline(ss, token, ','))
+  {
+    std::stringstream ts(token);
+    T value;
+    ts >> value;
+    values.push_back(value);
+  }
+
+  return values;
+}
+
+/**
+ * Default simulation options for an offscreen run
+ */
+inline ProgramOptions offscreenOptions(const char *program)
+{
+  std::string name(program);
+  char *defaultArgs[] = { &name[0] };
+  ProgramOptions options = parseOptions(1, defaultArgs);
+  options.offscreen = true;
+  options.debugContext = false;
+  options.exportImages = false;
+
+  return options;
+}
+
+#endif //BENCHUTILS_H
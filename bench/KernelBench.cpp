@@ -0,0 +1,256 @@
+#include "ProgramOptions.h"
+#include "GLFWHandler.h"
+#include "SimulationFactory.h"
+#include "BenchUtils.h"
+
+#include <cmath>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/********** Benchmark Configuration **********/
+struct KernelBenchOptions
+{
+  std::vector<unsigned> resolutions;
+  unsigned repetitions;
+  Interpolation interpolation;
+  std::string output;
+};
+
+KernelBenchOptions parseKernelBenchOptions(int argc, char* argv[])
+{
+  namespace po = boost::program_options;
+
+  KernelBenchOptions options;
+  std::string resolutions;
+
+  po::options_description po_options("kernel_bench [options]");
+  po_options.add_options()
+    ("resolutions", po::value<std::string>(&resolutions)->default_value("256,1024,2048"), "comma separated list of grid sizes")
+    ("repetitions", po::value<unsigned>(&options.repetitions)->default_value(20), "number of measured calls per kernel")
+    ("interpolation", po::value<Interpolation>(&options.interpolation)->default_value(EXACT), "interpolation mode of the advection kernels (exact, fast)")
+    ("output,o", po::value<std::string>(&options.output)->default_value("kernel_bench.json"), "JSON output file")
+    ("help,h", "display this message")
+  ;
+
+  try
+  {
+    po::variables_map vm;
+    po::store(po::command_line_parser(argc, argv).options(po_options).run(), vm);
+    po::notify(vm);
+
+    if(vm.count("help"))
+    {
+      std::cout << po_options;
+      std::exit(0);
+    }
+
+    options.resolutions = parseList<unsigned>(resolutions);
+  }
+  catch (std::exception& ex)
+  {
+    std::cout << ex.what() << std::endl;
+    std::cout << po_options;
+    std::exit(1);
+  }
+
+  return options;
+}
+
+/********** Synthetic Fields **********/
+struct SyntheticFields
+{
+  GLuint velocities[2];
+  GLuint density[4];
+  GLuint divergenceCurl;
+  GLuint pressure;
+  GLuint divergenceRB;
+  GLuint pressureRB;
+
+  SyntheticFields(const unsigned w, const unsigned h)
+  {
+    // A single Gaussian vortex in the middle of the domain
+    auto vortex = [w, h](unsigned x, unsigned y)
+    {
+      const float dx = (static_cast<float>(x) - 0.5f * w) / w;
+      const float dy = (static_cast<float>(y) - 0.5f * h) / h;
+      const float s = 50.0f * std::exp(- (dx * dx + dy * dy) / 0.05f);
+      return std::make_tuple(- s * dy, s * dx, 0.0f, 0.0f);
+    };
+
+    auto stripes = [](unsigned x, unsigned y)
+    {
+      return std::make_tuple(0.5f + 0.5f * std::sin(0.05f * x), 0.5f + 0.5f * std::cos(0.05f * y), 0.5f, 1.0f);
+    };
+
+    auto ramp = [w, h](unsigned x, unsigned y)
+    {
+      return std::make_tuple(static_cast<float>(x) / w - static_cast<float>(y) / h, 0.0f, 0.0f, 0.0f);
+    };
+
+    // Same formats as the simulations
+    for(GLuint& tex : velocities) tex = createTexture2D(w, h, GL_RG16F);
+    for(GLuint& tex : density) tex = createTexture2D(w, h);
+    divergenceCurl = createTexture2D(w, h, GL_RG16F);
+    pressure = createTexture2D(w, h, GL_R32F);
+    divergenceRB = createTexture2D((w + 1) / 2, (h + 1) / 2);
+    pressureRB = createTexture2D((w + 1) / 2, (h + 1) / 2);
+
+    fillTextureWithFunctor(velocities[0], w, h, vortex);
+    for(GLuint tex : density) fillTextureWithFunctor(tex, w, h, stripes);
+    fillTextureWithFunctor(pressure, w, h, ramp);
+  }
+
+  ~SyntheticFields()
+  {
+    deleteTextures(2, velocities);
+    deleteTextures(4, density);
+    deleteTextures(1, &divergenceCurl);
+    deleteTextures(1, &pressure);
+    deleteTextures(1, &divergenceRB);
+    deleteTextures(1, &pressureRB);
+  }
+};
+
+/********** Measurements **********/
+struct KernelResult
+{
+  std::string name;
+  unsigned resolution;
+  double msPerCall;
+  double nsPerCell;
+  double bytesPerCell;
+};
+
+KernelResult measure(SimulationFactory& sFact, const std::string& name, const unsigned resolution,
+    const unsigned repetitions, std::function<void()> kernel)
+{
+  // Warm-up call to exclude lazy driver work from the measurement
+  kernel();
+  glFinish();
+
+  sFact.resetTraffic();
+
+  GLuint query;
+  glGenQueries(1, &query);
+  glBeginQuery(GL_TIME_ELAPSED, query);
+  for(unsigned i = 0; i < repetitions; ++i) kernel();
+  glEndQuery(GL_TIME_ELAPSED);
+
+  GLuint64 elapsed;
+  glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed);
+  glDeleteQueries(1, &query);
+
+  const double cells = static_cast<double>(resolution) * resolution;
+
+  KernelResult result;
+  result.name = name;
+  result.resolution = resolution;
+  result.msPerCall = elapsed / 1000000.0 / repetitions;
+  result.nsPerCell = elapsed / cells / repetitions;
+  result.bytesPerCell = sFact.trafficBytes() / cells / repetitions;
+
+  return result;
+}
+
+std::vector<KernelResult> runKernels(const KernelBenchOptions& bench, ProgramOptions options, std::string& renderer)
+{
+  GLFWHandler handler(&options);
+  renderer = reinterpret_cast<const char*>(glGetString(GL_RENDERER));
+
+  std::vector<KernelResult> results;
+
+  {
+    SimulationFactory sFact(&options);
+    SyntheticFields f(options.simWidth, options.simHeight);
+
+    const unsigned n = options.simWidth;
+    const float dt = options.dt;
+    auto run = [&](const std::string& name, std::function<void()> kernel)
+    {
+      results.push_back(measure(sFact, name, n, bench.repetitions, kernel));
+    };
+
+    const GLuint departure = sFact.pool.acquire(options.simWidth, options.simHeight, GL_RG32F);
+    run("departure", [&]() { sFact.departure(f.velocities[0], departure, dt); });
+    sFact.pool.release(departure);
+
+    // The departure points are computed once, then shared by the following advections
+    run("RKAdvect", [&]() { sFact.RKAdvect(f.velocities[0], f.density[0], f.density[1], dt); });
+    run("maccormackStep", [&]() { sFact.maccormackStep(f.density[3], f.density[0], f.density[1], f.density[2], f.velocities[0]); });
+    run("divergenceCurl", [&]() { sFact.divergenceCurl(f.velocities[0], f.divergenceCurl); });
+    // The three force passes of the clouds, then the fused kernel that replaces them
+    run("forces_separate", [&]()
+    {
+      sFact.applyBuoyantForce(f.velocities[1], f.density[0], f.density[1], 0.25f, 0.1f, 15.0f);
+      sFact.divergenceCurl(f.velocities[1], f.divergenceCurl);
+      sFact.applyVorticity(f.velocities[1], f.divergenceCurl);
+    });
+    run("applyBodyForces", [&]() { sFact.applyBodyForces(f.velocities[0], f.velocities[1], f.density[0], f.density[1], 0.25f, 0.1f, 15.0f); });
+    const GLuint theta[3] = { f.density[1], f.density[2], f.density[3] };
+    run("updateQAndTheta", [&]() { sFact.updateQAndTheta(f.density[0], theta); });
+    run("divergenceRB", [&]() { sFact.divergenceRB(f.velocities[0], f.divergenceRB); });
+    run("jacobiRB", [&]() { sFact.jacobiRB(f.divergenceRB, f.pressureRB, 1); });
+    run("jacobiRB_x" + std::to_string(options.jacobiIterations), [&]() { sFact.jacobiRB(f.divergenceRB, f.pressureRB, options.jacobiIterations); });
+    run("pressureProjection", [&]() { sFact.pressureProjection(f.pressure, f.velocities[0], f.velocities[1]); });
+    run("pressureProjectionRB", [&]() { sFact.pressureProjectionRB(f.pressureRB, f.velocities[0], f.velocities[1]); });
+    run("maxReduce", [&]() { sFact.maxReduce(f.velocities[0]); });
+    run("addSplat", [&]() { sFact.addSplat(f.density[1], std::make_tuple(n / 2, n / 2), std::make_tuple(0.1f, 0.2f, 0.3f), 1.0f); sFact.flushSplats(); });
+  }
+
+  return results;
+}
+
+/********** Output **********/
+void writeJSON(std::ostream& os, const std::string& renderer, const std::vector<KernelResult>& results)
+{
+  os << "{\n";
+  os << "  \"renderer\": \"" << renderer << "\",\n";
+  os << "  \"kernels\": [\n";
+  for(std::size_t i = 0; i < results.size(); ++i)
+  {
+    const KernelResult& r = results[i];
+    os << "    { \"name\": \"" << r.name << "\", \"resolution\": " << r.resolution
+       << ", \"msPerCall\": " << r.msPerCall << ", \"nsPerCell\": " << r.nsPerCell
+       << ", \"bytesPerCell\": " << r.bytesPerCell << " }" << (i + 1 < results.size() ? "," : "") << "\n";
+  }
+  os << "  ]\n";
+  os << "}\n";
+}
+
+int main(int argc, char** argv)
+{
+  KernelBenchOptions bench = parseKernelBenchOptions(argc, argv);
+
+  const ProgramOptions defaults = offscreenOptions("kernel_bench");
+
+  std::string renderer;
+  std::vector<KernelResult> results;
+  for(unsigned resolution : bench.resolutions)
+  {
+    ProgramOptions options = defaults;
+    options.simWidth = resolution;
+    options.simHeight = resolution;
+    options.interpolation = bench.interpolation;
+
+    std::vector<KernelResult> r = runKernels(bench, options, renderer);
+    results.insert(results.end(), r.begin(), r.end());
+  }
+
+  std::cout << std::left << std::setw(24) << "kernel" << std::setw(12) << "size"
+            << std::setw(14) << "ms/call" << std::setw(14) << "ns/cell" << "bytes/cell" << std::endl;
+  for(const KernelResult& r : results)
+  {
+    std::cout << std::left << std::setw(24) << r.name << std::setw(12) << r.resolution
+              << std::setw(14) << r.msPerCall << std::setw(14) << r.nsPerCell << r.bytesPerCell << std::endl;
+  }
+
+  std::ofstream file(bench.output);
+  writeJSON(file, renderer, results);
+  std::cout << "Results written to " << bench.output << std::endl;
+
+  return 0;
+}
@@ -0,0 +1,251 @@
+#include "ProgramOptions.h"
+#include "GLFWHandler.h"
+#include "Simulations.h"
+#include "BenchUtils.h"
+
+#include <sys/resource.h>
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+/********** Benchmark Configuration **********/
+struct BenchOptions
+{
+  std::vector<SimulationType> simTypes;
+  std::vector<unsigned> resolutions;
+  std::vector<unsigned> jacobiIterations;
+  PressureSolverType pressureSolver;
+  unsigned warmupSteps;
+  unsigned measuredSteps;
+  bool activeTiles;
+  std::string output;
+};
+
+BenchOptions parseBenchOptions(int argc, char* argv[])
+{
+  namespace po = boost::program_options;
+
+  BenchOptions options;
+  std::string simTypes, resolutions, jacobi;
+
+  po::options_description po_options("sim_bench [options]");
+  po_options.add_options()
+    ("simTypes", po::value<std::string>(&simTypes)->default_value("splats,smoke,clouds"), "comma separated list of simulations")
+    ("resolutions", po::value<std::string>(&resolutions)->default_value("256,512,1024,2048,4096"), "comma separated list of grid sizes")
+    ("jacobi-iterations", po::value<std::string>(&jacobi)->default_value("50"), "comma separated list of Jacobi iteration counts")
+    ("pressure-solver", po::value<PressureSolverType>(&options.pressureSolver)->default_value(RED_BLACK), "pressure solver of the simulations (jacobi, red-black, mixed, cpu)")
+    ("warmup", po::value<unsigned>(&options.warmupSteps)->default_value(10), "number of steps before measuring")
+    ("steps", po::value<unsigned>(&options.measuredSteps)->default_value(50), "number of measured steps")
+    ("active-tiles", po::value<bool>(&options.activeTiles)->default_value(false), "restrict the dispatches of the smoke to its active tiles")
+    ("output,o", po::value<std::string>(&options.output)->default_value("sim_bench.json"), "JSON output file")
+    ("help,h", "display this message")
+  ;
+
+  try
+  {
+    po::variables_map vm;
+    po::store(po::command_line_parser(argc, argv).options(po_options).run(), vm);
+    po::notify(vm);
+
+    if(vm.count("help"))
+    {
+      std::cout << po_options;
+      std::exit(0);
+    }
+
+    options.simTypes = parseList<SimulationType>(simTypes);
+    options.resolutions = parseList<unsigned>(resolutions);
+    options.jacobiIterations = parseList<unsigned>(jacobi);
+  }
+  catch (std::exception& ex)
+  {
+    std::cout << ex.what() << std::endl;
+    std::cout << po_options;
+    std::exit(1);
+  }
+
+  return options;
+}
+
+/********** Host Memory **********/
+// getrusage() only gives the peak of the whole process, which would carry the largest
+// run over to the next ones. Linux resets the peak resident size (VmHWM) of the process
+// when 5 is written to /proc/self/clear_refs.
+bool resetPeakHostBytes()
+{
+  std::ofstream clearRefs("/proc/self/clear_refs");
+  clearRefs << "5";
+  clearRefs.close();
+  return static_cast<bool>(clearRefs);
+}
+
+long peakHostBytes(const bool perRun)
+{
+  std::ifstream status("/proc/self/status");
+  std::string line;
+  while(perRun && std::getline(status, line))
+  {
+    if(line.compare(0, 6, "VmHWM:") != 0) continue;
+
+    long kB = 0;
+    std::stringstream(line.substr(6)) >> kB;
+    return kB * 1024l;
+  }
+
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss * 1024l;
+}
+
+/********** Single Run **********/
+struct BenchResult
+{
+  SimulationType simType;
+  unsigned resolution;
+  unsigned jacobiIterations;
+  double msPerStep;
+  double gpuMsPerStep;
+  double bytesPerStep;
+  double barriersPerStep;
+  std::size_t peakTextureBytes;
+  long peakHostBytes;
+  bool peakHostPerRun;
+  std::map<std::string, GPUProfiler::PassStats> passes;
+};
+
+BenchResult runBenchmark(const BenchOptions& bench, ProgramOptions options)
+{
+  resetPeakTextureBytes();
+  const bool perRun = resetPeakHostBytes();
+
+  GLFWHandler handler(&options);
+  SimulationBase *sim = createSimulation(&options, &handler);
+  handler.attachSimulation(sim);
+
+  for(unsigned i = 0; i < bench.warmupSteps; ++i) sim->Update();
+  glFinish();
+
+  sim->sFact.profiler.enabled = true;
+  sim->sFact.profiler.reset();
+  sim->sFact.resetTraffic();
+
+  GLuint queryID[2];
+  glGenQueries(2, queryID);
+  glQueryCounter(queryID[0], GL_TIMESTAMP);
+
+  // The pass queries pile up during the loop, and are read once the single glFinish completed them
+  auto start = std::chrono::high_resolution_clock::now();
+  for(unsigned i = 0; i < bench.measuredSteps; ++i) sim->Update();
+  glQueryCounter(queryID[1], GL_TIMESTAMP);
+  glFinish();
+  std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+
+  sim->sFact.profiler.resolve();
+
+  GLuint64 startTime, stopTime;
+  glGetQueryObjectui64v(queryID[0], GL_QUERY_RESULT, &startTime);
+  glGetQueryObjectui64v(queryID[1], GL_QUERY_RESULT, &stopTime);
+  glDeleteQueries(2, queryID);
+
+  BenchResult result;
+  result.simType = options.simType;
+  result.resolution = options.simWidth;
+  result.jacobiIterations = options.jacobiIterations;
+  result.msPerStep = elapsed.count() / bench.measuredSteps;
+  result.gpuMsPerStep = (stopTime - startTime) / 1000000.0 / bench.measuredSteps;
+  result.bytesPerStep = static_cast<double>(sim->sFact.trafficBytes()) / bench.measuredSteps;
+  result.barriersPerStep = static_cast<double>(sim->sFact.barrierCount()) / bench.measuredSteps;
+  result.peakTextureBytes = peakTextureBytes();
+  result.peakHostBytes = peakHostBytes(perRun);
+  result.peakHostPerRun = perRun;
+  result.passes = sim->sFact.profiler.stats();
+
+  delete sim;
+
+  return result;
+}
+
+/********** JSON Output **********/
+void writeJSON(std::ostream& os, const BenchOptions& bench, const std::vector<BenchResult>& results)
+{
+  os << "{\n";
+  os << "  \"warmupSteps\": " << bench.warmupSteps << ",\n";
+  os << "  \"measuredSteps\": " << bench.measuredSteps << ",\n";
+  os << "  \"activeTiles\": " << (bench.activeTiles ? "true" : "false") << ",\n";
+  os << "  \"pressureSolver\": \"" << bench.pressureSolver << "\",\n";
+  os << "  \"runs\": [\n";
+  for(std::size_t i = 0; i < results.size(); ++i)
+  {
+    const BenchResult& r = results[i];
+    const double bandwidth = r.bytesPerStep / (r.gpuMsPerStep / 1000.0) / 1e9;
+
+    os << "    {\n";
+    os << "      \"simType\": \"" << r.simType << "\",\n";
+    os << "      \"resolution\": " << r.resolution << ",\n";
+    os << "      \"jacobiIterations\": " << r.jacobiIterations << ",\n";
+    os << "      \"msPerStep\": " << r.msPerStep << ",\n";
+    os << "      \"gpuMsPerStep\": " << r.gpuMsPerStep << ",\n";
+    os << "      \"stepsPerSecond\": " << 1000.0 / r.msPerStep << ",\n";
+    os << "      \"peakTextureBytes\": " << r.peakTextureBytes << ",\n";
+    os << "      \"peakHostBytes\": " << r.peakHostBytes << ",\n";
+    os << "      \"peakHostBytesPerRun\": " << (r.peakHostPerRun ? "true" : "false") << ",\n";
+    os << "      \"bytesPerStep\": " << r.bytesPerStep << ",\n";
+    os << "      \"barriersPerStep\": " << r.barriersPerStep << ",\n";
+    os << "      \"effectiveBandwidthGBs\": " << bandwidth << ",\n";
+    os << "      \"passes\": {";
+    bool first = true;
+    for(const auto& [name, stats] : r.passes)
+    {
+      os << (first ? "\n" : ",\n");
+      os << "        \"" << name << "\": { \"msPerStep\": " << stats.totalMs / bench.measuredSteps
+         << ", \"calls\": " << stats.count << " }";
+      first = false;
+    }
+    os << "\n      }\n";
+    os << "    }" << (i + 1 < results.size() ? "," : "") << "\n";
+  }
+  os << "  ]\n";
+  os << "}\n";
+}
+
+int main(int argc, char** argv)
+{
+  srand(0);
+
+  BenchOptions bench = parseBenchOptions(argc, argv);
+
+  const ProgramOptions defaults = offscreenOptions("sim_bench");
+
+  std::vector<BenchResult> results;
+  for(SimulationType simType : bench.simTypes)
+  {
+    for(unsigned resolution : bench.resolutions)
+    {
+      for(unsigned jacobi : bench.jacobiIterations)
+      {
+        ProgramOptions options = defaults;
+        options.simType = simType;
+        options.simWidth = resolution;
+        options.simHeight = resolution;
+        options.jacobiIterations = jacobi;
+        options.pressureSolver = bench.pressureSolver;
+        options.activeTiles = bench.activeTiles;
+
+        std::cout << "Running " << simType << " " << resolution << "x" << resolution
+                  << " (" << jacobi << " Jacobi iterations)" << std::endl;
+        results.push_back(runBenchmark(bench, options));
+        std::cout << "  " << results.back().msPerStep << " ms/step" << std::endl;
+      }
+    }
+  }
+
+  std::ofstream file(bench.output);
+  writeJSON(file, bench, results);
+  std::cout << "Results written to " << bench.output << std::endl;
+
+  return 0;
+}
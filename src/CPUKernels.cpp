@@ -0,0 +1,289 @@
+#include "CPUKernels.h"
+#include "HalfFloat.h"
+
+#include <algorithm>
+#include <thread>
+
+/********** Helpers **********/
+struct Vec2 { float x, y; };
+struct Vec4 { float x, y, z, w; };
+
+// Splits the rows in bands, one per hardware thread. f(begin, end) processes a band.
+template<typename F>
+static void parallelRows(const unsigned rows, const F& f)
+{
+  const unsigned hardware = std::max(std::thread::hardware_concurrency(), 1u);
+  const unsigned threads = std::min(hardware, std::max(rows / 16, 1u));
+  const unsigned band = (rows + threads - 1) / threads;
+
+  std::vector<std::thread> workers;
+  for(unsigned begin = band; begin < rows; begin += band)
+    workers.emplace_back(f, begin, std::min(begin + band, rows));
+
+  f(0u, std::min(band, rows));
+  for(auto& worker : workers) worker.join();
+}
+
+// Row y of the image in fp32, clamped to the image like texelFetchClamped
+static void loadRowClamped(const HalfImage& image, const int y, std::vector<float>& row)
+{
+  const int clamped = std::min(std::max(y, 0), static_cast<int>(image.height) - 1);
+  halfToFloat(image.row(clamped), row.data(), row.size());
+}
+
+// Row y of the image in fp32, zero outside of the image like an out of range texelFetch
+static void loadRowOrZero(const HalfImage& image, const int y, std::vector<float>& row)
+{
+  if(y < 0 || y >= static_cast<int>(image.height)) std::fill(row.begin(), row.end(), 0.0f);
+  else halfToFloat(image.row(y), row.data(), row.size());
+}
+
+static Vec4 texel(const std::vector<float>& row, const unsigned x)
+{
+  return { row[4 * x], row[4 * x + 1], row[4 * x + 2], row[4 * x + 3] };
+}
+
+static Vec4 mirrorPadding(Vec4 pC, const Vec4& pL, const Vec4& pB, const bool paddedX, const bool paddedY)
+{
+  if(paddedX) { pC.y = pL.y; pC.z = pL.z; }
+  if(paddedY) { pC.z = pB.z; pC.w = pB.w; }
+  return pC;
+}
+
+/********** Textures **********/
+static GLenum pixelFormat(const HalfImage& image)
+{
+  return image.channels == 2 ? GL_RG : GL_RGBA;
+}
+
+void readTextureHalf(const GLuint tex, HalfImage& image)
+{
+  glPixelStorei(GL_PACK_ALIGNMENT, 2);
+  glBindTexture(GL_TEXTURE_2D, tex);
+  glGetTexImage(GL_TEXTURE_2D, 0, pixelFormat(image), GL_HALF_FLOAT, image.texels.data());
+  glBindTexture(GL_TEXTURE_2D, 0);
+  glPixelStorei(GL_PACK_ALIGNMENT, 4);
+}
+
+void writeTextureHalf(const GLuint tex, const HalfImage& image)
+{
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 2);
+  glBindTexture(GL_TEXTURE_2D, tex);
+  glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, image.width, image.height, pixelFormat(image), GL_HALF_FLOAT, image.texels.data());
+  glBindTexture(GL_TEXTURE_2D, 0);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+}
+
+/********** Divergence **********/
+void divRB(const HalfImage& velocities, HalfImage& divergence)
+{
+  const int w = velocities.width, h = velocities.height;
+
+  parallelRows(divergence.height, [&](const unsigned begin, const unsigned end)
+  {
+    // Rows 2y - 1 to 2y + 2 of the velocities, with the points 0 to 3 of divRB.comp
+    std::vector<float> rows[4];
+    for(auto& row : rows) row.resize(2 * w);
+    std::vector<float> out(4 * divergence.width);
+
+    for(unsigned py = begin; py < end; ++py)
+    {
+      const int y = 2 * py;
+      for(int k = 0; k < 4; ++k) loadRowOrZero(velocities, y - 1 + k, rows[k]);
+
+      const bool paddedY = y + 1 >= h;
+      for(unsigned px = 0; px < divergence.width; ++px)
+      {
+        const int x = 2 * px;
+        const bool paddedX = x + 1 >= w;
+
+        // Point ij is the column x - 1 + i of the row y - 1 + j
+        auto field = [&](const int i, const int j) -> Vec2
+        {
+          const int c = x - 1 + i;
+          if(c < 0 || c >= w) return { 0.0f, 0.0f };
+          return { rows[j][2 * c], rows[j][2 * c + 1] };
+        };
+
+        const Vec2 field11 = field(1, 1);
+        Vec2 field01 = field(0, 1);
+        Vec2 field21 = field(2, 1);
+        Vec2 field10 = field(1, 0);
+        Vec2 field12 = field(1, 2);
+        Vec2 field20 = field(2, 0);
+        Vec2 field02 = field(0, 2);
+        Vec2 field13 = field(1, 3);
+        Vec2 field23 = field(2, 3);
+        Vec2 field22 = field(2, 2);
+        Vec2 field31 = field(3, 1);
+        Vec2 field32 = field(3, 2);
+
+        if(px == 0)
+        {
+          field01.x = - field11.x;
+          field02.x = - field12.x;
+        }
+        if(py == 0)
+        {
+          field10.y = - field11.y;
+          field20.y = - field21.y;
+        }
+        if(x + 1 >= w - 1)
+        {
+          field31.x = - field21.x;
+          field32.x = - field22.x;
+        }
+        if(y + 1 >= h - 1)
+        {
+          field13.y = - field12.y;
+          field23.y = - field22.y;
+        }
+        if(paddedX)
+        {
+          field21.x = - field11.x;
+          field22.x = - field12.x;
+        }
+        if(paddedY)
+        {
+          field12.y = - field11.y;
+          field22.y = - field21.y;
+        }
+
+        out[4 * px]     = 0.5f * (field21.x - field01.x + field12.y - field10.y);
+        out[4 * px + 1] = paddedX ? 0.0f : 0.5f * (field31.x - field11.x + field22.y - field20.y);
+        out[4 * px + 2] = paddedX || paddedY ? 0.0f : 0.5f * (field32.x - field12.x + field23.y - field21.y);
+        out[4 * px + 3] = paddedY ? 0.0f : 0.5f * (field22.x - field02.x + field13.y - field11.y);
+      }
+
+      floatToHalf(out.data(), divergence.row(py), out.size());
+    }
+  });
+}
+
+/********** Red-Black Jacobi **********/
+// The black pass updates the components x and z from the y and w of the neighbours,
+// and the red pass the opposite, so both update the pressure in place like the
+// shaders. A band only stores the components of its pass, which the other bands
+// never read.
+template<bool black>
+static void jacobiPass(const HalfImage& divergence, HalfImage& pressure, const unsigned gridWidth, const unsigned gridHeight)
+{
+  const unsigned pw = pressure.width;
+
+  parallelRows(pressure.height, [&](const unsigned begin, const unsigned end)
+  {
+    std::vector<float> rowB(4 * pw), rowC(4 * pw), rowT(4 * pw), rowD(4 * pw);
+    std::vector<std::uint16_t> out(4 * pw);
+    const unsigned first = black ? 0 : 1;
+
+    for(unsigned y = begin; y < end; ++y)
+    {
+      loadRowClamped(pressure, static_cast<int>(y) - 1, rowB);
+      loadRowClamped(pressure, y, rowC);
+      loadRowClamped(pressure, y + 1, rowT);
+      halfToFloat(divergence.row(y), rowD.data(), rowD.size());
+
+      const bool paddedY = 2 * y + 1 >= gridHeight;
+      for(unsigned x = 0; x < pw; ++x)
+      {
+        const Vec4 dC = texel(rowD, x);
+        const Vec4 pL = texel(rowC, x > 0 ? x - 1 : 0);
+        const Vec4 pR = texel(rowC, std::min(x + 1, pw - 1));
+        const Vec4 pB = texel(rowB, x);
+        const Vec4 pT = texel(rowT, x);
+        const Vec4 pC = mirrorPadding(texel(rowC, x), pL, pB, 2 * x + 1 >= gridWidth, paddedY);
+
+        // The red components are out of the black pass, and the black ones of the red pass
+        if(black)
+        {
+          rowD[4 * x]     = 0.25f * (pL.y + pC.y + pB.w + pC.w - dC.x);
+          rowD[4 * x + 2] = 0.25f * (pC.w + pR.w + pC.y + pT.y - dC.z);
+        }
+        else
+        {
+          rowD[4 * x + 1] = 0.25f * (pC.x + pR.x + pB.z + pC.z - dC.y);
+          rowD[4 * x + 3] = 0.25f * (pL.z + pC.z + pT.x + pC.x - dC.w);
+        }
+      }
+
+      floatToHalf(rowD.data(), out.data(), out.size());
+
+      std::uint16_t *p = pressure.row(y);
+      for(unsigned x = 0; x < pw; ++x)
+      {
+        p[4 * x + first]     = out[4 * x + first];
+        p[4 * x + first + 2] = out[4 * x + first + 2];
+      }
+    }
+  });
+}
+
+void jacobiBlack(const HalfImage& divergence, HalfImage& pressure, const unsigned gridWidth, const unsigned gridHeight)
+{
+  jacobiPass<true>(divergence, pressure, gridWidth, gridHeight);
+}
+
+void jacobiRed(const HalfImage& divergence, HalfImage& pressure, const unsigned gridWidth, const unsigned gridHeight)
+{
+  jacobiPass<false>(divergence, pressure, gridWidth, gridHeight);
+}
+
+/********** Pressure Projection **********/
+// Every packed texel only reads and writes its own 2x2 velocities, hence in place
+void pressureProjectionRB(const HalfImage& pressure, HalfImage& velocities)
+{
+  const unsigned pw = pressure.width;
+  const unsigned w = velocities.width, h = velocities.height;
+
+  parallelRows(pressure.height, [&](const unsigned begin, const unsigned end)
+  {
+    std::vector<float> rowB(4 * pw), rowC(4 * pw), rowT(4 * pw);
+    std::vector<float> vel[2] = { std::vector<float>(2 * w), std::vector<float>(2 * w) };
+
+    for(unsigned y = begin; y < end; ++y)
+    {
+      loadRowClamped(pressure, static_cast<int>(y) - 1, rowB);
+      loadRowClamped(pressure, y, rowC);
+      loadRowClamped(pressure, y + 1, rowT);
+
+      const bool paddedY = 2 * y + 1 >= h;
+      halfToFloat(velocities.row(2 * y), vel[0].data(), vel[0].size());
+      if(!paddedY) halfToFloat(velocities.row(2 * y + 1), vel[1].data(), vel[1].size());
+
+      for(unsigned x = 0; x < pw; ++x)
+      {
+        const bool paddedX = 2 * x + 1 >= w;
+        const Vec4 pL = texel(rowC, x > 0 ? x - 1 : 0);
+        const Vec4 pR = texel(rowC, std::min(x + 1, pw - 1));
+        const Vec4 pB = texel(rowB, x);
+        const Vec4 pT = texel(rowT, x);
+        const Vec4 pC = mirrorPadding(texel(rowC, x), pL, pB, paddedX, paddedY);
+
+        // r, g, b and a are the points (0, 0), (1, 0), (1, 1) and (0, 1) of the texel
+        float *r = &vel[0][4 * x], *g = r + 2;
+        float *a = &vel[1][4 * x], *b = a + 2;
+
+        r[0] -= 0.5f * (pC.y - pL.y);
+        r[1] -= 0.5f * (pC.w - pB.w);
+        if(!paddedX)
+        {
+          g[0] -= 0.5f * (pR.x - pC.x);
+          g[1] -= 0.5f * (pC.z - pB.z);
+        }
+        if(!paddedX && !paddedY)
+        {
+          b[0] -= 0.5f * (pR.w - pC.w);
+          b[1] -= 0.5f * (pT.y - pC.y);
+        }
+        if(!paddedY)
+        {
+          a[0] -= 0.5f * (pC.z - pL.z);
+          a[1] -= 0.5f * (pT.x - pC.x);
+        }
+      }
+
+      floatToHalf(vel[0].data(), velocities.row(2 * y), vel[0].size());
+      if(!paddedY) floatToHalf(vel[1].data(), velocities.row(2 * y + 1), vel[1].size());
+    }
+  });
+}
@@ -0,0 +1,66 @@
+#ifndef CPUKERNELS_H
+#define CPUKERNELS_H
+
+/**
+ * @file CPUKernels.h
+ * @brief CPU versions of the Red-Black pressure kernels on half precision images
+ *
+ * The images keep their texels in IEEE half like the GL_RG16F and GL_RGBA16F textures,
+ * so the kernels move as many bytes as the shaders. Each band of rows is converted to
+ * fp32 a few rows at a time (see HalfFloat.h), computed in fp32 like on the GPU, and
+ * rounded back to half. The rows are split between the hardware threads.
+ */
+
+#include "GLUtils.h"
+
+#include <cstdint>
+#include <vector>
+
+/**
+ * @struct HalfImage
+ * @brief Row major half precision texels
+ */
+struct HalfImage
+{
+  HalfImage(const unsigned width = 0, const unsigned height = 0, const unsigned channels = 4)
+    : width(width), height(height), channels(channels),
+      texels(static_cast<std::size_t>(width) * height * channels, 0) {}
+
+  std::uint16_t *row(const unsigned y) { return texels.data() + static_cast<std::size_t>(y) * width * channels; }
+  const std::uint16_t *row(const unsigned y) const { return texels.data() + static_cast<std::size_t>(y) * width * channels; }
+
+  unsigned width, height, channels;
+  std::vector<std::uint16_t> texels;
+};
+
+/**
+ * Reads a 2 or 4 channels texture into the image, converted to half by GL if needed
+ */
+void readTextureHalf(const GLuint tex, HalfImage& image);
+
+/**
+ * Writes the image into a 2 or 4 channels texture of the same size
+ */
+void writeTextureHalf(const GLuint tex, const HalfImage& image);
+
+/**
+ * Packed divergence of the velocities (divRB.comp)
+ */
+void divRB(const HalfImage& velocities, HalfImage& divergence);
+
+/**
+ * Black pass of the Red-Black Jacobi, in place (jacobiBlack.comp)
+ */
+void jacobiBlack(const HalfImage& divergence, HalfImage& pressure, const unsigned gridWidth, const unsigned gridHeight);
+
+/**
+ * Red pass of the Red-Black Jacobi, in place (jacobiRed.comp)
+ */
+void jacobiRed(const HalfImage& divergence, HalfImage& pressure, const unsigned gridWidth, const unsigned gridHeight);
+
+/**
+ * Subtracts the gradient of the packed pressure from the velocities, in place (pressureProjectionRB.comp)
+ */
+void pressureProjectionRB(const HalfImage& pressure, HalfImage& velocities);
+
+#endif //CPUKERNELS_H
@@ -1,5 +1,6 @@
 #include "Clouds.h"
 #include "GLUtils.h"
+#include "PassGraph.h"
 
 #include <string>
 #include <sstream>
@@ -8,57 +9,28 @@
 
 Clouds::~Clouds()
 {
-  glDeleteTextures(4, velocitiesTexture);
-  glDeleteTextures(4, density);
-  glDeleteTextures(1, &divergenceCurlTexture);
-  glDeleteTextures(2, pressureTexture);
-  glDeleteTextures(1, &emptyTexture);
+  deleteTextures(2, velocitiesTexture);
+  deleteTextures(2, density);
+  deleteTextures(2, potentialTemperature);
 }
 
 void Clouds::Init()
 {
   /********** Texture Initilization **********/
-  auto f = [](unsigned, unsigned)
-      {
-        return std::make_tuple(0.0f, 0.0f, 0.0f, 0.0f);
-      };  
-
-  auto f1 = [](unsigned, unsigned y)
-      {
-        if(y <= 5) return std::make_tuple(1.0f, 0.0f, 0.0f, 0.0f);
-        else return std::make_tuple(0.0f, 0.0f, 0.0f, 0.0f);
-      };
-
-  auto f2 = [](unsigned, unsigned y)
-      {
-        if(y <= 5) return std::make_tuple(20.0f, 0.0f, 0.0f, 0.0f);
-        else return std::make_tuple(0.0f, 0.0f, 0.0f, 0.0f);
-      };
-
-  density[0] = createTexture2D(options->simWidth, options->simHeight);
-  density[1] = createTexture2D(options->simWidth, options->simHeight);
-  density[2] = createTexture2D(options->simWidth, options->simHeight);
-  fillTextureWithFunctor(density[0], options->simWidth, options->simHeight, f1);
-
-  potentialTemperature[0] = createTexture2D(options->simWidth, options->simHeight);
-  potentialTemperature[1] = createTexture2D(options->simWidth, options->simHeight);
-  potentialTemperature[2] = createTexture2D(options->simWidth, options->simHeight);
-  fillTextureWithFunctor(potentialTemperature[0], options->simWidth, options->simHeight, f2);
-
-  velocitiesTexture[0] = createTexture2D(options->simWidth, options->simHeight);
-  velocitiesTexture[1] = createTexture2D(options->simWidth, options->simHeight);
-  velocitiesTexture[2] = createTexture2D(options->simWidth, options->simHeight);
-  fillTextureWithFunctor(velocitiesTexture[0], options->simWidth, options->simHeight, f);
-
-  divergenceCurlTexture = createTexture2D(options->simWidth, options->simHeight);
-  fillTextureWithFunctor(divergenceCurlTexture, options->simWidth, options->simHeight, f);
-
-  pressureTexture[0] = createTexture2D(options->simWidth, options->simHeight);
-  pressureTexture[1] = createTexture2D(options->simWidth, options->simHeight);
-  fillTextureWithFunctor(pressureTexture[0], options->simWidth, options->simHeight, f);
-
-  emptyTexture = createTexture2D(options->simWidth, options->simHeight);
-  fillTextureWithFunctor(emptyTexture, options->simWidth, options->simHeight, f);
+  // The textures start at zero, and the initial bands are written on the GPU
+  density[0] = createTexture2D(options->simWidth, options->simHeight, GL_RG16F, "density");
+  density[1] = createTexture2D(options->simWidth, options->simHeight, GL_RG16F, "density");
+  sFact.fillBand(density[0], 5, std::make_tuple(1.0f, 0.0f, 0.0f, 0.0f));
+
+  potentialTemperature[0] = createTexture2D(options->simWidth, options->simHeight, GL_R16F, "temperature");
+  potentialTemperature[1] = createTexture2D(options->simWidth, options->simHeight, GL_R16F, "temperature");
+  sFact.fillBand(potentialTemperature[0], 5, std::make_tuple(20.0f, 0.0f, 0.0f, 0.0f));
+
+  velocitiesTexture[0] = createTexture2D(options->simWidth, options->simHeight, GL_RG16F, "velocities");
+  velocitiesTexture[1] = createTexture2D(options->simWidth, options->simHeight, GL_RG16F, "velocities");
+
+  // Pressure and Exner terms of each row for the thermodynamics
+  sFact.setAtmosphere(SimulationFactory::Atmosphere());
 }
 
 void Clouds::AddSplat()
@@ -73,6 +45,13 @@ void Clouds::RemoveSplat()
 {
 }
 
+std::map<std::string, GLuint> Clouds::Fields() const
+{
+  return { { "velocities", velocitiesTexture[READ] },
+           { "density", density[READ] },
+           { "temperature", potentialTemperature[READ] } };
+}
+
 void Clouds::Update()
 {
   /********** Adding Clouds Origin *********/
@@ -89,39 +68,52 @@ void Clouds::Update()
   sFact.addSplat(velocitiesTexture[READ], std::make_tuple(x, y), std::make_tuple(2.0f * rd() - 1.0f, 0.0f, 0.0f), 75.0f);
   */
 
-  /********** Convection **********/
-  sFact.mcAdvect(velocitiesTexture[READ], velocitiesTexture);
-  std::swap(velocitiesTexture[0], velocitiesTexture[2]);
+  /********** Transient Fields **********/
+  // The backward advected temperature is kept alive for the thermodynamics update
+  const GLuint temperatureScratch[2] = { sFact.pool.acquire(options->simWidth, options->simHeight, GL_R16F),
+                                         sFact.pool.acquire(options->simWidth, options->simHeight, GL_R16F) };
 
-  /********** Advections **********/
-  sFact.mcAdvect(velocitiesTexture[READ], density);
-  std::swap(density[0], density[2]);
-  sFact.mcAdvect(velocitiesTexture[READ], potentialTemperature);
-  std::swap(potentialTemperature[0], potentialTemperature[2]);
+  /********** Step Passes **********/
+  // The advected velocities end up in vel[1], the forces write them back to vel[0] and the projection to vel[1]
+  PassGraph graph;
+  const GLuint vel[2] = { velocitiesTexture[READ], velocitiesTexture[WRITE] };
+  const GLuint den[2] = { density[READ], density[WRITE] };
+  const GLuint temp[2] = { potentialTemperature[READ], potentialTemperature[WRITE] };
 
-  /********** Buoyant Force **********/
-  sFact.applyBuoyantForce(velocitiesTexture[READ], potentialTemperature[READ], density[READ], 0.25f, 0.1f, 15.0f);
+  /********** Convection **********/
+  graph.add("advectVelocities", { vel[0] }, { vel[1] }, [this, vel]() { sFact.mcAdvect(vel[0], vel); });
 
-  /********** Divergence & Curl **********/
-  sFact.divergenceCurl(velocitiesTexture[READ], divergenceCurlTexture);
+  /********** Advections **********/
+  graph.add("advectDensity", { vel[1], den[0] }, { den[1] }, [this, vel, den]() { sFact.mcAdvect(vel[1], den); });
+  graph.add("advectTemperature", { vel[1], temp[0] }, { temp[1], temperatureScratch[0], temperatureScratch[1] },
+    [this, vel, temp, temperatureScratch]() { sFact.mcAdvect(vel[1], temp, temperatureScratch); });
 
-  /********** Vorticity **********/
-  sFact.applyVorticity(velocitiesTexture[READ], divergenceCurlTexture);
+  /********** Body Forces **********/
+  // Buoyancy and vorticity confinement in one pass
+  graph.add("bodyForces", { vel[1], temp[1], den[1] }, { vel[0] }, [this, vel, temp, den]()
+  {
+    sFact.applyBodyForces(vel[1], vel[0], temp[1], den[1], 0.25f, 0.1f, 15.0f);
+  });
 
   /********** Updating Thermodynamics *********/
-  sFact.updateQAndTheta(density[READ], potentialTemperature);
-
-  /********** Poisson Solving with Jacobi **********/
-  sFact.copy(emptyTexture, pressureTexture[READ]);
-  for(int k = 0; k < 25; ++k)
+  const GLuint theta[3] = { temp[1], temperatureScratch[0], temperatureScratch[1] };
+  graph.add("thermodynamics", { den[1], temp[1], temperatureScratch[1] }, { den[1], temperatureScratch[1] }, [this, den, theta]()
   {
-    sFact.solvePressure(divergenceCurlTexture, pressureTexture[READ], pressureTexture[WRITE]);
-    std::swap(pressureTexture[READ], pressureTexture[WRITE]);
-  }
+    sFact.updateQAndTheta(den[1], theta);
+  });
 
   /********** Pressure Projection **********/
-  sFact.pressureProjection(pressureTexture[READ], velocitiesTexture[READ], velocitiesTexture[WRITE]);
+  graph.add("projection", { vel[0] }, { vel[1] }, [this, vel]() { sFact.project(vel); });
+
+  graph.execute();
+  sFact.flushBarriers();
+
   std::swap(velocitiesTexture[READ], velocitiesTexture[WRITE]);
+  std::swap(density[READ], density[WRITE]);
+  std::swap(potentialTemperature[READ], potentialTemperature[WRITE]);
+
+  sFact.pool.release(temperatureScratch[0]);
+  sFact.pool.release(temperatureScratch[1]);
 
   /********** Updating the shared texture **********/
   shared_texture = density[READ];
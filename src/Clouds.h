@@ -18,15 +18,14 @@ class Clouds : public SimulationBase
     void AddSplat() override;
     void AddMultipleSplat(const int nb) override;
     void RemoveSplat() override;
+
+    std::map<std::string, GLuint> Fields() const override;
   private:
     int READ = 0, WRITE = 1;
 
-    GLuint velocitiesTexture[3];
-    GLuint density[3];
-    GLuint potentialTemperature[3];
-    GLuint divergenceCurlTexture;
-    GLuint pressureTexture[2];
-    GLuint emptyTexture;
+    GLuint velocitiesTexture[2];
+    GLuint density[2];
+    GLuint potentialTemperature[2];
 };
 
 #endif //CLOUD_H
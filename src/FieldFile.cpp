@@ -0,0 +1,159 @@
+#include "FieldFile.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static const char fieldMagic[4] = { 'F', 'L', 'D', '1' };
+
+// Bytes of the bands streamed through each pixel buffer
+static const std::size_t uploadBandBytes = 4 << 20;
+
+/********** Layout **********/
+FieldHeader fieldHeader(const unsigned width, const unsigned height, const unsigned channels, const FieldType type)
+{
+  FieldHeader header = {};
+  std::memcpy(header.magic, fieldMagic, sizeof(fieldMagic));
+  header.width = width;
+  header.height = height;
+  header.channels = channels;
+  header.type = type;
+  return header;
+}
+
+std::size_t fieldRowBytes(const FieldHeader& header)
+{
+  const std::size_t texelBytes = header.channels * (header.type == FIELD_FP16 ? sizeof(GLhalf) : sizeof(GLfloat));
+  return texelBytes * header.width;
+}
+
+/********** Mapped Field **********/
+MappedField::MappedField(const std::string& path)
+  : path(path)
+{
+#ifdef _WIN32
+  std::cout << "Loading " << path << " needs memory mapped files, which are not supported on this platform" << std::endl;
+  exit(1);
+#else
+  const int fd = open(path.c_str(), O_RDONLY);
+  struct stat status;
+  if(fd < 0 || fstat(fd, &status) != 0)
+  {
+    std::cout << "Cannot open the field " << path << ": " << std::strerror(errno) << std::endl;
+    exit(1);
+  }
+
+  size = status.st_size;
+  if(size < sizeof(FieldHeader))
+  {
+    std::cout << path << " is not a field file" << std::endl;
+    exit(1);
+  }
+
+  // The mapping keeps the file alive once the descriptor is closed
+  void *mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(mapping == MAP_FAILED)
+  {
+    std::cout << "Cannot map the field " << path << ": " << std::strerror(errno) << std::endl;
+    exit(1);
+  }
+
+  // The rows are read once from the first to the last
+  madvise(mapping, size, MADV_SEQUENTIAL);
+  data = static_cast<const unsigned char*>(mapping);
+#endif
+
+  const FieldHeader& h = header();
+  if(std::memcmp(h.magic, fieldMagic, sizeof(fieldMagic)) != 0
+      || (h.channels != 1 && h.channels != 2 && h.channels != 4)
+      || (h.type != FIELD_FP16 && h.type != FIELD_FP32))
+  {
+    std::cout << path << " is not a field file" << std::endl;
+    exit(1);
+  }
+
+  if(size < sizeof(FieldHeader) + fieldRowBytes(h) * h.height)
+  {
+    std::cout << "The field " << path << " is truncated, " << h.width << "x" << h.height << " texels are expected" << std::endl;
+    exit(1);
+  }
+}
+
+MappedField::~MappedField()
+{
+#ifndef _WIN32
+  if(data) munmap(const_cast<unsigned char*>(data), size);
+#endif
+}
+
+/********** Upload **********/
+void uploadField(const MappedField& field, const GLuint tex)
+{
+  const FieldHeader& header = field.header();
+  const auto [width, height] = textureSize(tex);
+
+  if(header.width != width || header.height != height || header.channels != textureChannels(tex))
+  {
+    std::cout << "The field " << field.path << " has " << header.channels << " channels on a "
+              << header.width << "x" << header.height << " grid, where " << textureChannels(tex)
+              << " channels on a " << width << "x" << height << " grid are expected" << std::endl;
+    exit(1);
+  }
+
+  if(textureSparse(tex))
+  {
+    std::cout << "The field " << field.path << " cannot be loaded into a sparse texture, run without --sparse-textures" << std::endl;
+    exit(1);
+  }
+
+  static const GLenum pixelFormats[] = { 0, GL_RED, GL_RG, 0, GL_RGBA };
+  const GLenum pixelFormat = pixelFormats[header.channels];
+  const GLenum pixelType = header.type == FIELD_FP16 ? GL_HALF_FLOAT : GL_FLOAT;
+
+  const std::size_t rowBytes = fieldRowBytes(header);
+  const unsigned bandRows = std::min<std::size_t>(std::max<std::size_t>(uploadBandBytes / rowBytes, 1), height);
+  const std::size_t bandBytes = rowBytes * bandRows;
+
+  // Two buffers, so the copy of a band overlaps the transfer of the previous one
+  GLuint buffers[2];
+  glGenBuffers(2, buffers);
+  for(const GLuint buffer : buffers)
+  {
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, bandBytes, nullptr, GL_STREAM_DRAW);
+    trackBuffer(buffer, bandBytes, "field upload");
+  }
+
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  glBindTexture(GL_TEXTURE_2D, tex);
+
+  unsigned band = 0;
+  for(unsigned y = 0; y < height; y += bandRows, ++band)
+  {
+    const unsigned rows = std::min(bandRows, height - y);
+
+    // Invalidating the buffer lets the driver hand out fresh storage if it is still being read
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffers[band % 2]);
+    void *staging = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, rowBytes * rows, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    std::memcpy(staging, field.row(y), rowBytes * rows);
+    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, y, width, rows, pixelFormat, pixelType, nullptr);
+  }
+
+  glBindTexture(GL_TEXTURE_2D, 0);
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+  deleteBuffers(2, buffers);
+}
@@ -0,0 +1,80 @@
+#ifndef FIELDFILE_H
+#define FIELDFILE_H
+
+/**
+ * @file FieldFile.h
+ * @brief Binary fields for the initial conditions and the obstacles
+ *
+ * A field file is a 32 bytes header followed by the texels in fp16 or fp32, with the
+ * channels interleaved and the rows going from the bottom of the grid to its top like
+ * the textures. Everything is little endian. The file is memory mapped and streamed
+ * to the texture a band of rows at a time through pixel buffers, so loading a field
+ * never holds more than two bands in host memory besides the page cache.
+ */
+
+#include "GLUtils.h"
+
+#include <cstdint>
+#include <string>
+
+enum FieldType : std::uint32_t
+{
+  FIELD_FP16 = 0,
+  FIELD_FP32 = 1
+};
+
+/**
+ * @struct FieldHeader
+ * @brief Header of a field file
+ */
+struct FieldHeader
+{
+  char magic[4];
+  std::uint32_t width, height;
+  std::uint32_t channels;
+  std::uint32_t type;
+  std::uint32_t reserved[3];
+};
+
+static_assert(sizeof(FieldHeader) == 32, "the field header is 32 bytes");
+
+/**
+ * Header of a field file with the given layout
+ * @param channels 1, 2 or 4
+ */
+FieldHeader fieldHeader(const unsigned width, const unsigned height, const unsigned channels, const FieldType type);
+
+/**
+ * Bytes of a row of texels
+ */
+std::size_t fieldRowBytes(const FieldHeader& header);
+
+/**
+ * @class MappedField
+ * @brief Read only memory mapping of a field file, checked against its header
+ */
+class MappedField
+{
+  public:
+    explicit MappedField(const std::string& path);
+    ~MappedField();
+
+    MappedField(const MappedField&) = delete;
+    MappedField& operator=(const MappedField&) = delete;
+
+    const FieldHeader& header() const { return *reinterpret_cast<const FieldHeader*>(data); }
+    const unsigned char *row(const unsigned y) const { return data + sizeof(FieldHeader) + static_cast<std::size_t>(y) * fieldRowBytes(header()); }
+
+    const std::string path;
+  private:
+    const unsigned char *data = nullptr;
+    std::size_t size = 0;
+};
+
+/**
+ * Streams a field into a texture of the same size and number of channels, a band of
+ * rows per pixel buffer upload. GL converts the texels to the format of the texture.
+ */
+void uploadField(const MappedField& field, const GLuint tex);
+
+#endif //FIELDFILE_H
@@ -1,8 +1,13 @@
 #include "GLFWHandler.h"
 #include "SimulationBase.h"
+#include "Simulations.h"
+#include "Metrics.h"
 #include "lodepng.h"
 
+#include <array>
+#include <atomic>
 #include <chrono>
+#include <thread>
 
 /********** Event Callbacks **********/
 static void glfwErrorCallback(int error, const char* description)
@@ -15,10 +20,11 @@ static void mouseCallback(GLFWwindow* window, int button, int action, int)
   if(button == GLFW_MOUSE_BUTTON_LEFT)
   {
     GLFWHandler *handler = (GLFWHandler*) glfwGetWindowUserPointer(window);
+    SimulationBase *simulation = handler->simulation;
     if(action == GLFW_PRESS || handler->leftMouseButtonLastState == GLFW_PRESS)
-      handler->simulation->AddSplat();
+      handler->postEvent([simulation]() { simulation->AddSplat(); });
     else if(action == GLFW_RELEASE)
-      handler->simulation->RemoveSplat();
+      handler->postEvent([simulation]() { simulation->RemoveSplat(); });
   }
 }
 
@@ -27,7 +33,8 @@ static void keyCallback(GLFWwindow* window, int key, int, int action, int)
   if(key == GLFW_KEY_E && action == GLFW_PRESS)
   {
     GLFWHandler *handler = (GLFWHandler*) glfwGetWindowUserPointer(window);
-    handler->simulation->AddMultipleSplat(10);
+    SimulationBase *simulation = handler->simulation;
+    handler->postEvent([simulation]() { simulation->AddMultipleSplat(10); });
   }
 
   if(key == GLFW_KEY_ESCAPE && action == GLFW_PRESS)
@@ -44,6 +51,108 @@ static void windowResizeCallback(GLFWwindow* window, int width, int height)
 }
 /*************************************/
 
+static void enableDebugOutput(const ProgramOptions *options)
+{
+  GLint flags;
+  glGetIntegerv(GL_CONTEXT_FLAGS, &flags);
+  if(flags & GL_CONTEXT_FLAG_DEBUG_BIT)
+  {
+    glEnable(GL_DEBUG_OUTPUT);
+    glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+    glDebugMessageCallback(MessageCallback, 0);
+    glDebugMessageControl(GL_DONT_CARE, GL_DONT_CARE, GL_DONT_CARE, 0, nullptr, GL_TRUE);
+  }
+  else if(options->debugContext)
+  {
+    std::cout << "Failed to init debug context" << std::endl;
+  }
+}
+
+/********** Frame Exchange **********/
+// Triple buffer between the simulation and render threads. The simulation copies each
+// finished frame into the back texture and swaps it with the ready one, and the render
+// thread swaps the ready texture with the front one when it holds a newer frame, so
+// neither thread waits for the other. The fences order the copy of a frame before its
+// draw, and the draw before the next copy into the same texture.
+class FrameExchange
+{
+  public:
+    ~FrameExchange()
+    {
+      for(Slot& slot : slots)
+      {
+        if(slot.written) glDeleteSync(slot.written);
+        if(slot.read) glDeleteSync(slot.read);
+        if(slot.tex) deleteTextures(1, &slot.tex);
+      }
+    }
+
+    // Simulation thread, after a step
+    void publish(const GLuint frame)
+    {
+      Slot& slot = slots[back];
+      auto [w, h] = textureSize(frame);
+      if(slot.tex == 0) slot.tex = createTexture2D(w, h, textureFormat(frame), "display");
+
+      // The last draw of the texture, and a frame that was never shown
+      if(slot.read) glWaitSync(slot.read, 0, GL_TIMEOUT_IGNORED);
+      if(slot.read) glDeleteSync(slot.read);
+      if(slot.written) glDeleteSync(slot.written);
+      slot.read = slot.written = 0;
+
+      glCopyImageSubData(frame, GL_TEXTURE_2D, 0, 0, 0, 0, slot.tex, GL_TEXTURE_2D, 0, 0, 0, 0, w, h, 1);
+      slot.written = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+      // The other context can only wait on a fence that was flushed
+      glFlush();
+
+      std::lock_guard<std::mutex> lock(mutex);
+      std::swap(back, ready);
+      fresh = true;
+    }
+
+    // Render thread, returns the latest frame or 0 before the first one
+    GLuint acquire()
+    {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        if(fresh) std::swap(front, ready);
+        fresh = false;
+      }
+
+      Slot& slot = slots[front];
+      if(slot.written)
+      {
+        glWaitSync(slot.written, 0, GL_TIMEOUT_IGNORED);
+        glDeleteSync(slot.written);
+        slot.written = 0;
+      }
+
+      return slot.tex;
+    }
+
+    // Render thread, after the draw of the acquired frame
+    void release()
+    {
+      Slot& slot = slots[front];
+      if(slot.tex == 0) return;
+      if(slot.read) glDeleteSync(slot.read);
+      slot.read = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+      glFlush();
+    }
+  private:
+    struct Slot
+    {
+      GLuint tex = 0;
+      GLsync written = 0, read = 0;
+    };
+
+    std::array<Slot, 3> slots;
+    unsigned back = 0, ready = 1, front = 2;
+    bool fresh = false;
+    std::mutex mutex;
+};
+
 GLFWHandler::GLFWHandler(ProgramOptions *options)
   : options(options)
 {
@@ -59,7 +168,8 @@ GLFWHandler::GLFWHandler(ProgramOptions *options)
   glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
   glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
   glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_COMPAT_PROFILE);
-  glfwWindowHint(GLFW_OPENGL_DEBUG_CONTEXT, GL_TRUE);
+  glfwWindowHint(GLFW_OPENGL_DEBUG_CONTEXT, options->debugContext ? GL_TRUE : GL_FALSE);
+  glfwWindowHint(GLFW_VISIBLE, options->offscreen ? GLFW_FALSE : GLFW_TRUE);
 
   window = glfwCreateWindow(options->windowWidth, options->windowHeight, "Fluid Simulation", NULL, NULL);
   if(!window)
@@ -83,21 +193,9 @@ GLFWHandler::GLFWHandler(ProgramOptions *options)
   printf("Supported GLSL version is %s.\n",
       glGetString(GL_SHADING_LANGUAGE_VERSION));
 
-  glfwSwapInterval(1);
+  glfwSwapInterval(options->offscreen ? 0 : 1);
 
-  GLint flags;
-  glGetIntegerv(GL_CONTEXT_FLAGS, &flags);
-  if(flags & GL_CONTEXT_FLAG_DEBUG_BIT)
-  {
-    glEnable(GL_DEBUG_OUTPUT);
-    glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
-    glDebugMessageCallback(MessageCallback, 0);
-    glDebugMessageControl(GL_DONT_CARE, GL_DONT_CARE, GL_DONT_CARE, 0, nullptr, GL_TRUE);
-  }
-  else
-  {
-    std::cout << "Failed to init debug context" << std::endl;
-  }
+  enableDebugOutput(options);
 
   /********** Configuring pipeline *********/
   const float vertices[] =
@@ -155,6 +253,39 @@ void GLFWHandler::attachSimulation(SimulationBase* sim)
   simulation->Init();
 }
 
+void GLFWHandler::postEvent(std::function<void()> event)
+{
+  std::lock_guard<std::mutex> lock(eventMutex);
+  events.push_back(std::move(event));
+}
+
+void GLFWHandler::processEvents()
+{
+  std::vector<std::function<void()>> pending;
+  {
+    std::lock_guard<std::mutex> lock(eventMutex);
+    pending.swap(events);
+  }
+
+  for(auto& event : pending) event();
+}
+
+void GLFWHandler::pollEvents()
+{
+  glfwPollEvents();
+
+  // GLFW is only called from this thread, the simulation reads the stored position
+  double x, y;
+  glfwGetCursorPos(window, &x, &y);
+  cursorX = x / options->windowWidth;
+  cursorY = 1.0 - y / options->windowHeight;
+}
+
+std::tuple<double, double> GLFWHandler::cursor() const
+{
+  return std::make_tuple(cursorX.load(), cursorY.load());
+}
+
 void GLFWHandler::registerEvent()
 {
   glfwSetWindowUserPointer(window, this);
@@ -179,6 +310,7 @@ void GLFWHandler::run()
   glSamplerParameteri(linearSampler, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
 
   /********** Compute shader timings ***********/
+  // Query objects are not shared, they belong to the context running the steps
   GLint64 startTime, stopTime;
   GLuint queryID[2];
 
@@ -189,17 +321,27 @@ void GLFWHandler::run()
   /********** Array of images for the export **********/
   std::vector<unsigned char*> buffers;
 
+  /********** Metrics **********/
+  // The per-pass timings come from the profiler, which only runs when the metrics are exported
+  MetricsExporter exporter(options);
+  simulation->sFact.profiler.enabled = exporter.enabled();
+
   char text[100];
+  bool memoryReported = false;
 
-  /********** Rendering & Simulation Loop ***********/
-  while (!glfwWindowShouldClose(window))
+  /********** Simulation Step **********/
+  auto step = [&]()
   {
-    /********** Generating queries for timing **********/
-    glGenQueries(2, queryID);
+    /********** Events of the window **********/
+    processEvents();
+
     glQueryCounter(queryID[0], GL_TIMESTAMP);
+    const auto stepStart = std::chrono::high_resolution_clock::now();
 
     /********** Updating the simulation **********/
-    simulation->Update();
+    // Only the last of the steps of a frame is displayed and exported
+    double simulatedTime = 0.0;
+    for(unsigned k = 0; k < std::max(options->stepsPerFrame, 1u); ++k) simulatedTime += advanceSimulation(simulation);
 
     /********** Compute shader execution time *********/
     glQueryCounter(queryID[1], GL_TIMESTAMP);
@@ -214,7 +356,7 @@ void GLFWHandler::run()
 
     std::chrono::high_resolution_clock::time_point
       current = std::chrono::high_resolution_clock::now();
-    sumOfDeltaT += options->dt;
+    sumOfDeltaT += simulatedTime;
     std::chrono::duration<double, std::milli> timeSpan = current - start;
 
     sprintf(text, "\rDelta from real time: %.4f s (%.3f ms, %.5f dt)"
@@ -224,37 +366,155 @@ void GLFWHandler::run()
     printf("%s", text);
     fflush(stdout);
 
-    glfwPollEvents();
+    /********** Recording the metrics **********/
+    Metrics& m = metrics();
+    m.steps.add(std::max(options->stepsPerFrame, 1u));
+    m.stepSeconds.observe(std::chrono::duration<double>(current - stepStart).count());
+    m.gpuStepSeconds.set((stopTime - startTime) / 1e9);
+    m.realTimeDelta.set(sumOfDeltaT - timeSpan.count() / 1000.0);
+    m.dt.set(options->dt);
+    m.textureBytes.set(allocatedTextureBytes());
+    m.peakTextureBytes.set(peakTextureBytes());
+
+    // The transient textures are allocated by the first step
+    if(!memoryReported)
+    {
+      memoryReported = true;
+      std::cout << std::endl;
+      printMemoryReport(std::cout);
+    }
 
-    /********** Rendering the texture **********/
+    if(exporter.enabled())
+    {
+      // The queries of the previous step, which do not stall the pipeline
+      GPUProfiler& profiler = simulation->sFact.profiler;
+      if(profiler.resolveFrame())
+        for(const auto& pass : profiler.stats()) m.passSeconds.set(pass.first, pass.second.totalMs / 1000.0);
+
+      for(const auto& entry : memoryByTag())
+      {
+        m.gpuBytes.set(entry.first, entry.second.gpuBytes);
+        m.hostBytes.set(entry.first, entry.second.hostBytes);
+      }
+
+      // Read back asynchronously, the norm lags the step by the latency of the GPU. The
+      // passes of the norm are not part of the step.
+      float norm;
+      if(simulation->sFact.divergenceNorm(norm)) m.divergenceNorm.set(norm);
+
+      auto fields = simulation->Fields();
+      auto velocities = fields.find("velocities");
+      profiler.enabled = false;
+      if(velocities != fields.end()) simulation->sFact.requestDivergenceNorm(velocities->second);
+      profiler.enabled = true;
+    }
+
+    /********** Saving texture for the export **********/
+    if(options->exportImages)
+    {
+      unsigned char *colors = new unsigned char[3 * options->simWidth * options->simHeight];
+      glBindTexture(GL_TEXTURE_2D, simulation->shared_texture);
+      glPixelStorei(GL_PACK_ALIGNMENT, 1); // Rows of RGB bytes are not 4-byte aligned for arbitrary widths
+      glGetTexImage(GL_TEXTURE_2D, 0, GL_RGB, GL_UNSIGNED_BYTE, colors);
+      buffers.push_back(colors);
+      trackHostBytes("export", 3ll * options->simWidth * options->simHeight);
+      metrics().exportQueueDepth.set(buffers.size());
+    }
+  };
+
+  /********** Rendering the texture **********/
+  auto render = [&](const GLuint tex)
+  {
     int displayW, displayH;
     glfwGetFramebufferSize(window, &displayW, &displayH);
     glViewport(0, 0, displayW, displayH);
 
     glClearColor(0.0, 0.0, 0.0, 1.0);
     glClear(GL_COLOR_BUFFER_BIT);
+    if(tex == 0) return;
 
     glUseProgram(shader_program);
     glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, simulation->shared_texture);
+    glBindTexture(GL_TEXTURE_2D, tex);
     glBindSampler(0, linearSampler);
 
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
     glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
 
     glBindSampler(0, 0);
+  };
 
-    /********** Saving texture for the export **********/
-    if(options->exportImages)
+  if(!options->simThread)
+  {
+    /********** Rendering & Simulation Loop ***********/
+    glGenQueries(2, queryID);
+    while (!glfwWindowShouldClose(window))
     {
-      unsigned char *colors = new unsigned char[3 * options->simWidth * options->simHeight];
-      glGetTexImage(GL_TEXTURE_2D, 0, GL_RGB, GL_UNSIGNED_BYTE, colors);
-      buffers.push_back(colors);
+      step();
+      pollEvents();
+      render(simulation->shared_texture);
+      glfwSwapBuffers(window);
+    }
+    glDeleteQueries(2, queryID);
+  }
+  else
+  {
+    /********** Simulation Thread **********/
+    // Hidden window whose context shares the textures, buffers and programs of the main one
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    GLFWwindow *simContext = glfwCreateWindow(1, 1, "Simulation", NULL, window);
+    if(!simContext)
+    {
+      std::cerr << "GLFW shared context creation failed!" << std::endl;
+      std::exit(1);
     }
 
-    glfwSwapBuffers(window);
+    // The objects created by Init() must be complete before the other context uses them
+    glFinish();
+
+    FrameExchange frames;
+    std::atomic<bool> stopping{false};
+    std::thread simThread([&]()
+    {
+      glfwMakeContextCurrent(simContext);
+      enableDebugOutput(options);
+      glGenQueries(2, queryID);
+
+      while(!stopping)
+      {
+        step();
+        frames.publish(simulation->shared_texture);
+      }
+
+      glDeleteQueries(2, queryID);
+      glFinish();
+      glfwMakeContextCurrent(NULL);
+    });
+
+    /********** Rendering Loop ***********/
+    // The swap waits for vsync here, and never for the simulation
+    while (!glfwWindowShouldClose(window))
+    {
+      pollEvents();
+      if(glfwGetWindowAttrib(window, GLFW_ICONIFIED))
+      {
+        glfwWaitEventsTimeout(0.1);
+        continue;
+      }
+
+      render(frames.acquire());
+      frames.release();
+      glfwSwapBuffers(window);
+    }
+
+    stopping = true;
+    simThread.join();
+    glfwDestroyWindow(simContext);
   }
 
+  std::cout << std::endl;
+  glDeleteSamplers(1, &linearSampler);
+
   /********** Exporting the frames to the disk **********/
   if(options->exportImages)
   {
@@ -276,6 +536,7 @@ void GLFWHandler::run()
       unsigned error = lodepng_encode24_file(path, reversed, w, h);
       if(error) std::cout << "Encode Error: " << error << ": " << lodepng_error_text(error) << std::endl;
       delete[] colors;
+      trackHostBytes("export", - 3ll * w * h);
     };
 
     for(unsigned int i = 0; i < buffers.size(); ++i)
@@ -13,7 +13,12 @@
  */
 
 
+#include <atomic>
+#include <functional>
 #include <iostream>
+#include <mutex>
+#include <tuple>
+#include <vector>
 
 #include "GLUtils.h"
 #include "ProgramOptions.h"
@@ -53,10 +58,23 @@ class GLFWHandler
     void attachSimulation(SimulationBase* sim);
 
     /**
-     * Main rendering loop
+     * Main rendering loop. With --sim-thread, the steps run on a thread of their own
+     * with a shared context, and the loop shows the latest finished frame at vsync.
      */
     void run();
 
+    /**
+     * Queues a call to the simulation, made before its next step on the thread running
+     * the steps. The window callbacks go through here.
+     */
+    void postEvent(std::function<void()> event);
+
+    /**
+     * Cursor position from the last poll of the events, from (0, 0) at the bottom left
+     * of the window to (1, 1) at its top right
+     */
+    std::tuple<double, double> cursor() const;
+
     /**
      * The program options
      */
@@ -82,6 +100,16 @@ class GLFWHandler
      */
     void registerEvent();
 
+    /**
+     * Polls the window events and stores the cursor position
+     */
+    void pollEvents();
+
+    /**
+     * Runs the queued calls to the simulation
+     */
+    void processEvents();
+
     /**
      * Shader Program ID
      */
@@ -91,4 +119,8 @@ class GLFWHandler
      * EBO ID
      */
     GLuint ebo;
+
+    std::mutex eventMutex;
+    std::vector<std::function<void()>> events;
+    std::atomic<double> cursorX{0.0}, cursorY{0.0};
 };
@@ -3,6 +3,66 @@
 #include <iostream>
 #include <fstream>
 #include <sstream>
+#include <unordered_map>
+#include <algorithm>
+#include <iomanip>
+
+/********** Texture Memory Registry **********/
+struct TextureInfo
+{
+  unsigned width, height;
+  GLenum format;
+  std::size_t bytes;
+  std::string tag;
+
+  // Committed pages of the sparse textures, empty for the others
+  unsigned pageWidth = 0, pageHeight = 0;
+  std::vector<bool> committed;
+};
+
+// Channels and bytes per texel of the sized formats used by the simulations
+static std::tuple<unsigned, std::size_t> formatLayout(const GLenum format)
+{
+  switch(format)
+  {
+    case GL_R8:      return std::make_tuple(1u, sizeof(GLubyte));
+    case GL_R16F:    return std::make_tuple(1u, sizeof(GLhalf));
+    case GL_RG16F:   return std::make_tuple(2u, 2 * sizeof(GLhalf));
+    case GL_RGBA16F: return std::make_tuple(4u, 4 * sizeof(GLhalf));
+    case GL_R32F:    return std::make_tuple(1u, sizeof(GLfloat));
+    case GL_RG32F:   return std::make_tuple(2u, 2 * sizeof(GLfloat));
+    case GL_RGBA32F: return std::make_tuple(4u, 4 * sizeof(GLfloat));
+  }
+
+  std::cerr << "Unsupported texture format " << format << std::endl;
+  exit(1);
+}
+
+static std::unordered_map<GLuint, TextureInfo> textureRegistry;
+static std::size_t allocatedBytes = 0;
+static std::size_t peakBytes = 0;
+
+struct BufferInfo
+{
+  std::size_t bytes;
+  std::string tag;
+};
+
+static std::unordered_map<GLuint, BufferInfo> bufferRegistry;
+static std::size_t bufferBytes = 0;
+static std::map<std::string, long long> hostBytes;
+static std::size_t memoryBudget = 0;
+
+// Exits with the report when the allocation would go over --memory-budget
+static void checkMemoryBudget(const std::size_t bytes, const std::string& tag)
+{
+  if(memoryBudget == 0 || allocatedBytes + bufferBytes + bytes <= memoryBudget) return;
+
+  std::cerr << "Allocating " << bytes / (1024.0 * 1024.0) << " MB for " << tag << " goes over the memory budget of "
+            << memoryBudget / (1024.0 * 1024.0) << " MB" << std::endl;
+  printMemoryReport(std::cerr);
+  exit(1);
+}
 
 void APIENTRY MessageCallback(GLenum source,
     GLenum type,
@@ -50,8 +110,134 @@ void APIENTRY MessageCallback(GLenum source,
   std::cout << std::endl;
 }
 
-GLuint createTexture2D(const unsigned width, const unsigned height)
+/********** Texture Clears **********/
+// glClearTexImage and glClearTexSubImage (GL 4.4 or ARB_clear_texture), which are not part of the generated loader
+typedef void (APIENTRYP PFNGLCLEARTEXIMAGEPROC)(GLuint texture, GLint level, GLenum format, GLenum type, const void *data);
+typedef void (APIENTRYP PFNGLCLEARTEXSUBIMAGEPROC)(GLuint texture, GLint level, GLint xoffset, GLint yoffset, GLint zoffset,
+  GLsizei width, GLsizei height, GLsizei depth, GLenum format, GLenum type, const void *data);
+static PFNGLCLEARTEXIMAGEPROC glClearTexImage = nullptr;
+static PFNGLCLEARTEXSUBIMAGEPROC glClearTexSubImage = nullptr;
+
+bool clearTextureSupported()
+{
+  static int supported = -1;
+  if(supported >= 0) return supported == 1;
+
+  GLint major, minor;
+  glGetIntegerv(GL_MAJOR_VERSION, &major);
+  glGetIntegerv(GL_MINOR_VERSION, &minor);
+  bool clear = major > 4 || (major == 4 && minor >= 4);
+
+  GLint count;
+  glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+  for(GLint i = 0; i < count && !clear; ++i)
+    clear = std::string(reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, i))) == "GL_ARB_clear_texture";
+
+  if(clear)
+  {
+    glClearTexImage = (PFNGLCLEARTEXIMAGEPROC) glfwGetProcAddress("glClearTexImage");
+    glClearTexSubImage = (PFNGLCLEARTEXSUBIMAGEPROC) glfwGetProcAddress("glClearTexSubImage");
+  }
+  supported = glClearTexImage != nullptr && glClearTexSubImage != nullptr ? 1 : 0;
+  return supported == 1;
+}
+
+void clearTexture(const GLuint tex)
+{
+  // A null clear value is zero in every channel
+  if(clearTextureSupported())
+  {
+    glClearTexImage(tex, 0, GL_RGBA, GL_FLOAT, nullptr);
+    return;
+  }
+
+  // The float formats of the fields are all color renderable
+  GLint previous;
+  glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &previous);
+
+  GLuint fbo;
+  glGenFramebuffers(1, &fbo);
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, fbo);
+  glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, tex, 0);
+
+  const GLfloat zero[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+  glClearBufferfv(GL_COLOR, 0, zero);
+
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, previous);
+  glDeleteFramebuffers(1, &fbo);
+}
+
+GLuint createTexture2D(const unsigned width, const unsigned height, const GLenum format, const char *tag)
+{
+  const std::size_t texelBytes = std::get<1>(formatLayout(format));
+  const std::size_t bytes = texelBytes * static_cast<std::size_t>(width) * height;
+  checkMemoryBudget(bytes, tag);
+
+  GLuint tex;
+  glGenTextures(1, &tex);
+  glBindTexture(GL_TEXTURE_2D, tex);
+
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+  // Immutable storage, cleared on the GPU instead of uploading zeros from the host
+  glTexStorage2D(GL_TEXTURE_2D, 1, format, width, height);
+
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  clearTexture(tex);
+
+  textureRegistry[tex] = { width, height, format, bytes, tag, 0, 0, {} };
+  allocatedBytes += bytes;
+  peakBytes = std::max(peakBytes, allocatedBytes);
+
+  return tex;
+}
+
+/********** Sparse Textures **********/
+typedef void (APIENTRYP PFNGLTEXPAGECOMMITMENTARBPROC)(GLenum target, GLint level, GLint xoffset, GLint yoffset, GLint zoffset,
+  GLsizei width, GLsizei height, GLsizei depth, GLboolean commit);
+static PFNGLTEXPAGECOMMITMENTARBPROC glTexPageCommitmentARB = nullptr;
+
+bool sparseTexturesSupported()
+{
+  static int supported = -1;
+  if(supported >= 0) return supported == 1;
+
+  bool sparse = false, sparse2 = false;
+  GLint count;
+  glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+  for(GLint i = 0; i < count; ++i)
+  {
+    const std::string extension(reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, i)));
+    sparse = sparse || extension == "GL_ARB_sparse_texture";
+    sparse2 = sparse2 || extension == "GL_ARB_sparse_texture2";
+  }
+
+  if(sparse && sparse2) glTexPageCommitmentARB = (PFNGLTEXPAGECOMMITMENTARBPROC) glfwGetProcAddress("glTexPageCommitmentARB");
+  supported = glTexPageCommitmentARB != nullptr ? 1 : 0;
+  return supported == 1;
+}
+
+std::tuple<unsigned, unsigned> sparsePageSize(const GLenum format)
+{
+  GLint x, y;
+  glGetInternalformativ(GL_TEXTURE_2D, format, GL_VIRTUAL_PAGE_SIZE_X_ARB, 1, &x);
+  glGetInternalformativ(GL_TEXTURE_2D, format, GL_VIRTUAL_PAGE_SIZE_Y_ARB, 1, &y);
+  return std::make_tuple(static_cast<unsigned>(x), static_cast<unsigned>(y));
+}
+
+GLuint createSparseTexture2D(const unsigned width, const unsigned height, const GLenum format, const char *tag)
 {
+  auto [pageWidth, pageHeight] = sparsePageSize(format);
+  if(width % pageWidth != 0 || height % pageHeight != 0)
+  {
+    std::cerr << "Sparse textures need dimensions multiple of " << pageWidth << "x" << pageHeight << std::endl;
+    exit(1);
+  }
 
   GLuint tex;
   glGenTextures(1, &tex);
@@ -63,21 +249,209 @@ GLuint createTexture2D(const unsigned width, const unsigned height)
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
-  const std::vector<float> data(4 * width * height, 0.0f);
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, width, height, 0, GL_RGBA, GL_FLOAT, data.data());
+  // Sparse textures need an immutable storage, which reserves the address space only
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_SPARSE_ARB, GL_TRUE);
+  glTexStorage2D(GL_TEXTURE_2D, 1, format, width, height);
 
   glBindTexture(GL_TEXTURE_2D, 0);
 
+  const std::vector<bool> committed((width / pageWidth) * (height / pageHeight), false);
+  textureRegistry[tex] = { width, height, format, 0, tag, pageWidth, pageHeight, committed };
+
   return tex;
 }
 
-GLuint compileShader(const std::string& s, GLenum type)
+void commitTexturePages(const GLuint tex, const unsigned x, const unsigned y, const unsigned width, const unsigned height, const bool commit)
+{
+  TextureInfo& info = textureRegistry.at(tex);
+  const unsigned pagesX = info.width / info.pageWidth;
+  const std::size_t pageBytes = std::get<1>(formatLayout(info.format)) * info.pageWidth * info.pageHeight;
+
+  if(commit) checkMemoryBudget(pageBytes * (width / info.pageWidth) * (height / info.pageHeight), info.tag);
+
+  glBindTexture(GL_TEXTURE_2D, tex);
+  glTexPageCommitmentARB(GL_TEXTURE_2D, 0, x, y, 0, width, height, 1, commit ? GL_TRUE : GL_FALSE);
+
+  // The content of the committed pages is undefined until written
+  if(commit && clearTextureSupported())
+  {
+    glClearTexSubImage(tex, 0, x, y, 0, width, height, 1, GL_RGBA, GL_FLOAT, nullptr);
+  }
+  else if(commit)
+  {
+    const std::vector<float> zeros(4 * static_cast<std::size_t>(width) * height, 0.0f);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, width, height, GL_RGBA, GL_FLOAT, zeros.data());
+  }
+
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  for(unsigned py = y / info.pageHeight; py < (y + height) / info.pageHeight; ++py)
+  {
+    for(unsigned px = x / info.pageWidth; px < (x + width) / info.pageWidth; ++px)
+    {
+      if(info.committed[py * pagesX + px] == commit) continue;
+
+      info.committed[py * pagesX + px] = commit;
+      if(commit) allocatedBytes += pageBytes;
+      else allocatedBytes -= pageBytes;
+      info.bytes = commit ? info.bytes + pageBytes : info.bytes - pageBytes;
+    }
+  }
+  peakBytes = std::max(peakBytes, allocatedBytes);
+}
+
+void deleteTextures(const GLsizei n, const GLuint *textures)
+{
+  for(GLsizei i = 0; i < n; ++i)
+  {
+    auto it = textureRegistry.find(textures[i]);
+    if(it == textureRegistry.end()) continue;
+
+    allocatedBytes -= it->second.bytes;
+    textureRegistry.erase(it);
+  }
+
+  glDeleteTextures(n, textures);
+}
+
+std::size_t textureBytes(const GLuint tex)
+{
+  auto it = textureRegistry.find(tex);
+  return it == textureRegistry.end() ? 0 : it->second.bytes;
+}
+
+std::tuple<unsigned, unsigned> textureSize(const GLuint tex)
+{
+  auto it = textureRegistry.find(tex);
+  if(it == textureRegistry.end()) return std::make_tuple(0u, 0u);
+  return std::make_tuple(it->second.width, it->second.height);
+}
+
+GLenum textureFormat(const GLuint tex)
+{
+  auto it = textureRegistry.find(tex);
+  return it == textureRegistry.end() ? GL_RGBA16F : it->second.format;
+}
+
+unsigned textureChannels(const GLuint tex)
+{
+  return std::get<0>(formatLayout(textureFormat(tex)));
+}
+
+bool textureSparse(const GLuint tex)
+{
+  auto it = textureRegistry.find(tex);
+  return it != textureRegistry.end() && !it->second.committed.empty();
+}
+
+std::size_t allocatedTextureBytes()
+{
+  return allocatedBytes;
+}
+
+std::size_t peakTextureBytes()
+{
+  return peakBytes;
+}
+
+void resetPeakTextureBytes()
+{
+  peakBytes = allocatedBytes;
+}
+
+/********** Memory Accounting **********/
+void trackBuffer(const GLuint buffer, const std::size_t bytes, const char *tag)
+{
+  auto it = bufferRegistry.find(buffer);
+  const std::size_t previous = it == bufferRegistry.end() ? 0 : it->second.bytes;
+  if(bytes > previous) checkMemoryBudget(bytes - previous, tag);
+
+  bufferBytes = bufferBytes - previous + bytes;
+  bufferRegistry[buffer] = { bytes, tag };
+}
+
+void deleteBuffers(const GLsizei n, const GLuint *buffers)
+{
+  for(GLsizei i = 0; i < n; ++i)
+  {
+    auto it = bufferRegistry.find(buffers[i]);
+    if(it == bufferRegistry.end()) continue;
+
+    bufferBytes -= it->second.bytes;
+    bufferRegistry.erase(it);
+  }
+
+  glDeleteBuffers(n, buffers);
+}
+
+void trackHostBytes(const char *tag, const long long bytes)
+{
+  hostBytes[tag] += bytes;
+}
+
+std::map<std::string, MemoryUsage> memoryByTag()
+{
+  std::map<std::string, MemoryUsage> usage;
+  for(const auto& texture : textureRegistry) usage[texture.second.tag].gpuBytes += texture.second.bytes;
+  for(const auto& buffer : bufferRegistry) usage[buffer.second.tag].gpuBytes += buffer.second.bytes;
+  for(const auto& host : hostBytes) if(host.second > 0) usage[host.first].hostBytes += host.second;
+  return usage;
+}
+
+std::size_t allocatedGPUBytes()
+{
+  return allocatedBytes + bufferBytes;
+}
+
+void setMemoryBudget(const std::size_t bytes)
+{
+  memoryBudget = bytes;
+}
+
+void printMemoryReport(std::ostream& os)
+{
+  auto mb = [](const std::size_t bytes) { return bytes / (1024.0 * 1024.0); };
+
+  os << "Memory (MB)         GPU        host" << std::endl;
+  MemoryUsage total;
+  for(const auto& entry : memoryByTag())
+  {
+    os << std::left << std::setw(16) << entry.first << std::right << std::fixed << std::setprecision(2)
+       << std::setw(10) << mb(entry.second.gpuBytes) << std::setw(12) << mb(entry.second.hostBytes) << std::endl;
+    total.gpuBytes += entry.second.gpuBytes;
+    total.hostBytes += entry.second.hostBytes;
+  }
+  os << std::left << std::setw(16) << "total" << std::right << std::setw(10) << mb(total.gpuBytes)
+     << std::setw(12) << mb(total.hostBytes) << std::endl;
+  if(memoryBudget != 0) os << "budget" << std::setw(20) << mb(memoryBudget) << std::endl;
+  os << std::defaultfloat;
+}
+
+std::vector<float> readTexture2D(const GLuint tex, const unsigned width, const unsigned height)
+{
+  std::vector<float> data(4 * static_cast<std::size_t>(width) * height);
+  glBindTexture(GL_TEXTURE_2D, tex);
+  glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_FLOAT, data.data());
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  return data;
+}
+
+GLuint compileShader(const std::string& s, GLenum type, const std::string& defines)
 {
   std::cout << "Compiling " << s << "...";
   std::ifstream shader_file(s);
   std::ostringstream shader_buffer;
   shader_buffer << shader_file.rdbuf();
   std::string shader_string = preprocessIncludes(shader_buffer.str(), "shaders/simulation/", 32);
+
+  // The defines go right after the #version directive, which has to come first
+  if(!defines.empty())
+  {
+    const std::size_t versionEnd = shader_string.find('\n', shader_string.find("#version"));
+    shader_string.insert(versionEnd + 1, defines);
+  }
+
   const GLchar *shader_source = shader_string.c_str();
 
   GLuint shader_id = glCreateShader(type);
@@ -98,13 +472,16 @@ GLuint compileShader(const std::string& s, GLenum type)
   }
 }
 
-GLuint compileAndLinkShader(const std::string& s, GLenum type)
+GLuint compileAndLinkShader(const std::string& s, GLenum type, const std::string& defines)
 {
-  GLuint shader = compileShader(s, type);
+  GLuint shader = compileShader(s, type, defines);
   GLuint program = glCreateProgram();
   glAttachShader(program, shader);
   glLinkProgram(program);
 
+  // The shader object is released along with the program
+  glDeleteShader(shader);
+
   return program;
 }
 
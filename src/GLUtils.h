@@ -1,3 +1,6 @@
+#ifndef GLUTILS_H
+#define GLUTILS_H
+
 #include "glad.h"
 
 #ifdef __unix__
@@ -8,10 +11,21 @@
 #include <GLFW/glfw3.h>
 #include <GLFW/glfw3native.h>
 
+#include <map>
+#include <ostream>
 #include <string>
+#include <tuple>
+#include <vector>
 
 #include <boost/regex.hpp>
 
+// ARB_sparse_texture, which is not part of the generated loader
+#ifndef GL_TEXTURE_SPARSE_ARB
+#define GL_TEXTURE_SPARSE_ARB 0x91A6
+#define GL_VIRTUAL_PAGE_SIZE_X_ARB 0x9195
+#define GL_VIRTUAL_PAGE_SIZE_Y_ARB 0x9196
+#endif
+
 void APIENTRY MessageCallback(GLenum source,
     GLenum type,
     GLuint id,
@@ -20,7 +34,98 @@ void APIENTRY MessageCallback(GLenum source,
     const GLchar* message,
     const void* userParam);
 
-GLuint createTexture2D(const unsigned width, const unsigned height);
-GLuint compileShader(const std::string& s, GLenum type);
-GLuint compileAndLinkShader(const std::string& s, GLenum type);
+/**
+ * Whether glClearTexImage is available (GL 4.4 or ARB_clear_texture)
+ */
+bool clearTextureSupported();
+
+/**
+ * Sets every texel of a texture to zero on the GPU, through glClearTexImage or a
+ * framebuffer clear. The clear is a GL command, after which the shaders see zeros
+ * without a barrier; the image stores before it still need GL_TEXTURE_UPDATE_BARRIER_BIT.
+ */
+void clearTexture(const GLuint tex);
+
+/**
+ * Allocates a zero initialized texture with immutable storage, clamped edges and linear filtering
+ * @param width the texture width
+ * @param height the texture height
+ * @param format the sized internal format (GL_R16F, GL_RG16F, GL_R32F, GL_RGBA16F, ...)
+ * @param tag the memory report entry the texture counts towards
+ */
+GLuint createTexture2D(const unsigned width, const unsigned height, const GLenum format = GL_RGBA16F, const char *tag = "untagged");
+
+/**
+ * Whether the sparse textures are available, with uncommitted pages reading as zero
+ * (ARB_sparse_texture and ARB_sparse_texture2)
+ */
+bool sparseTexturesSupported();
+
+/**
+ * Size in texels of the pages of the sparse textures of a format
+ */
+std::tuple<unsigned, unsigned> sparsePageSize(const GLenum format);
+
+/**
+ * Allocates a sparse texture without any committed page, whose dimensions must be
+ * multiples of the page size. Only the committed pages count as allocated memory.
+ */
+GLuint createSparseTexture2D(const unsigned width, const unsigned height, const GLenum format, const char *tag = "untagged");
+
+/**
+ * Commits or decommits the pages of a sparse texture covering a region, which is
+ * aligned on the pages. The newly committed pages are cleared to zero.
+ */
+void commitTexturePages(const GLuint tex, const unsigned x, const unsigned y, const unsigned width, const unsigned height, const bool commit);
+
+void deleteTextures(const GLsizei n, const GLuint *textures);
+std::size_t textureBytes(const GLuint tex);
+std::tuple<unsigned, unsigned> textureSize(const GLuint tex);
+GLenum textureFormat(const GLuint tex);
+unsigned textureChannels(const GLuint tex);
+bool textureSparse(const GLuint tex);
+std::size_t allocatedTextureBytes();
+std::size_t peakTextureBytes();
+void resetPeakTextureBytes();
+
+/********** Memory Accounting **********/
+/**
+ * Records the size of a buffer after its glBufferData, replacing its previous size
+ */
+void trackBuffer(const GLuint buffer, const std::size_t bytes, const char *tag);
+void deleteBuffers(const GLsizei n, const GLuint *buffers);
+
+/**
+ * Adds (or removes, with a negative count) host bytes to a tag of the memory report
+ */
+void trackHostBytes(const char *tag, const long long bytes);
+
+/**
+ * GPU and host bytes allocated under a tag
+ */
+struct MemoryUsage
+{
+  std::size_t gpuBytes = 0;
+  std::size_t hostBytes = 0;
+};
+
+std::map<std::string, MemoryUsage> memoryByTag();
+
+/**
+ * Bytes of the textures and buffers
+ */
+std::size_t allocatedGPUBytes();
+
+/**
+ * Largest GPU bytes of the textures and buffers, 0 for no limit. An allocation going
+ * over it prints the memory report and exits, before the driver starts paging.
+ */
+void setMemoryBudget(const std::size_t bytes);
+
+void printMemoryReport(std::ostream& os);
+std::vector<float> readTexture2D(const GLuint tex, const unsigned width, const unsigned height);
+GLuint compileShader(const std::string& s, GLenum type, const std::string& defines = "");
+GLuint compileAndLinkShader(const std::string& s, GLenum type, const std::string& defines = "");
 std::string preprocessIncludes(const std::string source, const std::string shader_path, int level);
+
+#endif //GLUTILS_H
@@ -0,0 +1,101 @@
+#include "GPUProfiler.h"
+
+GPUProfiler::Scope::Scope(GPUProfiler *profiler, const char *name)
+  : profiler(profiler), index(-1)
+{
+  if(!profiler->enabled) return;
+
+  PendingPass pass = { name, profiler->acquireQuery(), profiler->acquireQuery() };
+  glQueryCounter(pass.begin, GL_TIMESTAMP);
+
+  index = static_cast<int>(profiler->pending.size());
+  profiler->pending.push_back(pass);
+}
+
+GPUProfiler::Scope::~Scope()
+{
+  if(index < 0) return;
+  glQueryCounter(profiler->pending[index].end, GL_TIMESTAMP);
+}
+
+GPUProfiler::~GPUProfiler()
+{
+  pending.insert(pending.end(), previousFrame.begin(), previousFrame.end());
+  for(const PendingPass& pass : pending)
+  {
+    freeQueries.push_back(pass.begin);
+    freeQueries.push_back(pass.end);
+  }
+
+  if(!freeQueries.empty()) glDeleteQueries(freeQueries.size(), freeQueries.data());
+}
+
+GLuint GPUProfiler::acquireQuery()
+{
+  if(freeQueries.empty())
+  {
+    GLuint query;
+    glGenQueries(1, &query);
+    return query;
+  }
+
+  GLuint query = freeQueries.back();
+  freeQueries.pop_back();
+  return query;
+}
+
+void GPUProfiler::accumulate(const std::vector<PendingPass>& passes)
+{
+  for(const PendingPass& pass : passes)
+  {
+    GLuint64 begin, end;
+    glGetQueryObjectui64v(pass.begin, GL_QUERY_RESULT, &begin);
+    glGetQueryObjectui64v(pass.end, GL_QUERY_RESULT, &end);
+
+    PassStats& s = passStats[pass.name];
+    s.totalMs += (end - begin) / 1000000.0;
+    s.count += 1;
+
+    freeQueries.push_back(pass.begin);
+    freeQueries.push_back(pass.end);
+  }
+}
+
+void GPUProfiler::resolve()
+{
+  accumulate(previousFrame);
+  accumulate(pending);
+  previousFrame.clear();
+  pending.clear();
+}
+
+bool GPUProfiler::resolveFrame()
+{
+  bool resolved = false;
+  if(!previousFrame.empty())
+  {
+    // The queries complete in order, the last one tells for the whole frame
+    GLint available = 0;
+    glGetQueryObjectiv(previousFrame.back().end, GL_QUERY_RESULT_AVAILABLE, &available);
+    if(!available)
+    {
+      previousFrame.insert(previousFrame.end(), pending.begin(), pending.end());
+      pending.clear();
+      return false;
+    }
+
+    passStats.clear();
+    accumulate(previousFrame);
+    resolved = true;
+  }
+
+  previousFrame.swap(pending);
+  pending.clear();
+  return resolved;
+}
+
+void GPUProfiler::reset()
+{
+  resolve();
+  passStats.clear();
+}
@@ -0,0 +1,102 @@
+#ifndef GPUPROFILER_H
+#define GPUPROFILER_H
+
+/**
+ * @file GPUProfiler.h
+ * @brief Per-pass GPU timings based on timestamp queries
+ */
+
+#include "GLUtils.h"
+
+#include <map>
+#include <string>
+#include <vector>
+
+/**
+ * @class GPUProfiler
+ * @brief Records a pair of timestamp queries around each named pass
+ *
+ * The queries are only read back in resolve(), so recording a pass never
+ * stalls the pipeline. When disabled, scopes are free.
+ */
+class GPUProfiler
+{
+  public:
+    /**
+     * Accumulated timings of a pass
+     */
+    struct PassStats
+    {
+      double totalMs = 0.0;
+      unsigned long count = 0;
+    };
+
+    /**
+     * RAII helper closing the pass it opened
+     */
+    class Scope
+    {
+      public:
+        Scope(GPUProfiler *profiler, const char *name);
+        ~Scope();
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+      private:
+        GPUProfiler *profiler;
+        int index;
+    };
+
+    GPUProfiler() = default;
+    ~GPUProfiler();
+
+    /**
+     * Opens a timed scope named after the pass
+     * @param name name of the pass
+     */
+    Scope scope(const char *name) { return Scope(this, name); }
+
+    /**
+     * Waits for the pending queries and accumulates them into the stats
+     */
+    void resolve();
+
+    /**
+     * Replaces the stats with the passes of the previous frame, and starts the next frame
+     * with the passes recorded since. The queries are only read once the GPU has written
+     * them, so this never waits: while they are pending, the frames are merged.
+     * @return whether the stats were replaced
+     */
+    bool resolveFrame();
+
+    /**
+     * Clears the accumulated stats
+     */
+    void reset();
+
+    /**
+     * Accumulated stats per pass name
+     */
+    const std::map<std::string, PassStats>& stats() const { return passStats; }
+
+    /**
+     * Recording state
+     */
+    bool enabled = false;
+  private:
+    struct PendingPass
+    {
+      const char *name;
+      GLuint begin, end;
+    };
+
+    GLuint acquireQuery();
+
+    std::vector<GLuint> freeQueries;
+    void accumulate(const std::vector<PendingPass>& passes);
+
+    std::vector<PendingPass> pending, previousFrame;
+    std::map<std::string, PassStats> passStats;
+};
+
+#endif //GPUPROFILER_H
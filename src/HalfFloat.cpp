@@ -0,0 +1,128 @@
+#include "HalfFloat.h"
+
+#include <cstring>
+
+// The F16C path is compiled for the conversion functions only and picked at run time,
+// so the binaries keep running on the CPUs without it
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HALF_FLOAT_F16C
+#include <immintrin.h>
+#endif
+
+float halfToFloat(const std::uint16_t h)
+{
+  const std::uint32_t sign = static_cast<std::uint32_t>(h & 0x8000u) << 16;
+  std::uint32_t exponent = (h >> 10) & 0x1fu;
+  std::uint32_t mantissa = h & 0x3ffu;
+
+  std::uint32_t bits;
+  if(exponent == 0x1fu) bits = sign | 0x7f800000u | (mantissa << 13);
+  else if(exponent != 0) bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+  else if(mantissa == 0) bits = sign;
+  else
+  {
+    // Subnormal halves are normal floats
+    exponent = 113;
+    while(!(mantissa & 0x400u))
+    {
+      mantissa <<= 1;
+      --exponent;
+    }
+    bits = sign | (exponent << 23) | ((mantissa & 0x3ffu) << 13);
+  }
+
+  float f;
+  std::memcpy(&f, &bits, sizeof(f));
+  return f;
+}
+
+std::uint16_t floatToHalf(const float f)
+{
+  std::uint32_t bits;
+  std::memcpy(&bits, &f, sizeof(bits));
+
+  const std::uint32_t sign = (bits >> 16) & 0x8000u;
+  bits &= 0x7fffffffu;
+
+  // Infinities and NaNs, then the values rounding above 65504
+  if(bits >= 0x7f800000u) return static_cast<std::uint16_t>(sign | 0x7c00u | (bits > 0x7f800000u ? 0x200u : 0u));
+  if(bits >= 0x477ff000u) return static_cast<std::uint16_t>(sign | 0x7c00u);
+
+  std::uint32_t h, remainder, halfway;
+  if(bits >= 0x38800000u)
+  {
+    // Normal halves, the carry of the rounding moves to the exponent
+    h = (((bits >> 23) - 112) << 10) | ((bits >> 13) & 0x3ffu);
+    remainder = bits & 0x1fffu;
+    halfway = 0x1000u;
+  }
+  else if(bits >= 0x33000000u)
+  {
+    // Subnormal halves, in units of 2^-24
+    const std::uint32_t shift = 126 - (bits >> 23);
+    const std::uint32_t mantissa = (bits & 0x7fffffu) | 0x800000u;
+    h = mantissa >> shift;
+    remainder = mantissa & ((1u << shift) - 1);
+    halfway = 1u << (shift - 1);
+  }
+  else return static_cast<std::uint16_t>(sign);
+
+  if(remainder > halfway || (remainder == halfway && (h & 1u))) ++h;
+  return static_cast<std::uint16_t>(sign | h);
+}
+
+#ifdef HALF_FLOAT_F16C
+__attribute__((target("avx,f16c")))
+static void halfToFloatF16C(const std::uint16_t *src, float *dst, const std::size_t n)
+{
+  std::size_t i = 0;
+  for(; i + 8 <= n; i += 8)
+    _mm256_storeu_ps(dst + i, _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i))));
+  for(; i < n; ++i) dst[i] = halfToFloat(src[i]);
+}
+
+__attribute__((target("avx,f16c")))
+static void floatToHalfF16C(const float *src, std::uint16_t *dst, const std::size_t n)
+{
+  std::size_t i = 0;
+  for(; i + 8 <= n; i += 8)
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT));
+  for(; i < n; ++i) dst[i] = floatToHalf(src[i]);
+}
+#endif
+
+bool hasF16C()
+{
+#ifdef HALF_FLOAT_F16C
+  static const bool f16c = __builtin_cpu_supports("avx") && __builtin_cpu_supports("f16c");
+  return f16c;
+#else
+  return false;
+#endif
+}
+
+void halfToFloat(const std::uint16_t *src, float *dst, const std::size_t n)
+{
+#ifdef HALF_FLOAT_F16C
+  if(hasF16C())
+  {
+    halfToFloatF16C(src, dst, n);
+    return;
+  }
+#endif
+
+  for(std::size_t i = 0; i < n; ++i) dst[i] = halfToFloat(src[i]);
+}
+
+void floatToHalf(const float *src, std::uint16_t *dst, const std::size_t n)
+{
+#ifdef HALF_FLOAT_F16C
+  if(hasF16C())
+  {
+    floatToHalfF16C(src, dst, n);
+    return;
+  }
+#endif
+
+  for(std::size_t i = 0; i < n; ++i) dst[i] = floatToHalf(src[i]);
+}
@@ -0,0 +1,37 @@
+#ifndef HALFFLOAT_H
+#define HALFFLOAT_H
+
+/**
+ * @file HalfFloat.h
+ * @brief IEEE half precision conversions of the CPU kernels
+ */
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Half to float conversion of a single value
+ */
+float halfToFloat(const std::uint16_t h);
+
+/**
+ * Float to half conversion of a single value, rounding to nearest even like GL_RGBA16F
+ */
+std::uint16_t floatToHalf(const float f);
+
+/**
+ * Converts n halves to floats, 8 at a time with F16C when the CPU has it
+ */
+void halfToFloat(const std::uint16_t *src, float *dst, const std::size_t n);
+
+/**
+ * Converts n floats to halves, 8 at a time with F16C when the CPU has it
+ */
+void floatToHalf(const float *src, std::uint16_t *dst, const std::size_t n);
+
+/**
+ * Whether the conversions of arrays run on the F16C instructions
+ */
+bool hasF16C();
+
+#endif //HALFFLOAT_H
@@ -0,0 +1,278 @@
+#include "Metrics.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#ifndef _WIN32
+#include <poll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+/********** Histogram **********/
+Metrics::Histogram::Histogram(const std::vector<double>& bounds)
+  : bounds(bounds), buckets(bounds.size() + 1)
+{
+}
+
+void Metrics::Histogram::observe(const double v)
+{
+  unsigned bucket = 0;
+  while(bucket < bounds.size() && v > bounds[bucket]) ++bucket;
+  buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+
+  // Only the simulation thread observes, so the sum does not need a compare-exchange
+  sum.set(sum.get() + v);
+  count.add();
+}
+
+/********** Metrics **********/
+Metrics::Metrics()
+  : stepSeconds({ 0.001, 0.002, 0.005, 0.01, 0.02, 0.05, 0.1, 0.2, 0.5, 1.0, 2.0, 5.0 })
+{
+}
+
+/********** Labeled Gauges **********/
+void Metrics::LabeledGauges::set(const std::string& label, const double v)
+{
+  for(auto& slot : slots)
+  {
+    if(slot.used.load(std::memory_order_relaxed))
+    {
+      if(label == slot.label)
+      {
+        slot.value.set(v);
+        return;
+      }
+      continue;
+    }
+
+    // The label is published before the slot, for the exporter thread
+    std::snprintf(slot.label, sizeof(slot.label), "%s", label.c_str());
+    slot.value.set(v);
+    slot.used.store(true, std::memory_order_release);
+    return;
+  }
+}
+
+void Metrics::LabeledGauges::render(std::ostream& out, const char *name, const char *help, const char *labelName) const
+{
+  out << "# HELP " << name << " " << help << "\n"
+      << "# TYPE " << name << " gauge\n";
+  for(const auto& slot : slots)
+  {
+    if(!slot.used.load(std::memory_order_acquire)) break;
+    out << name << "{" << labelName << "=\"" << slot.label << "\"} " << slot.value.get() << "\n";
+  }
+}
+
+std::string Metrics::render() const
+{
+  std::ostringstream out;
+  out.precision(12);
+
+  auto gauge = [&out](const char *name, const char *help, const double value)
+  {
+    out << "# HELP " << name << " " << help << "\n"
+        << "# TYPE " << name << " gauge\n"
+        << name << " " << value << "\n";
+  };
+
+  out << "# HELP fluidsim_steps_total Simulation steps since the start\n"
+      << "# TYPE fluidsim_steps_total counter\n"
+      << "fluidsim_steps_total " << steps.get() << "\n";
+
+  out << "# HELP fluidsim_step_seconds Wall time of the steps, until their GPU work completes\n"
+      << "# TYPE fluidsim_step_seconds histogram\n";
+  std::uint64_t cumulative = 0;
+  for(unsigned b = 0; b < stepSeconds.buckets.size(); ++b)
+  {
+    cumulative += stepSeconds.buckets[b].load(std::memory_order_relaxed);
+    out << "fluidsim_step_seconds_bucket{le=\"";
+    if(b < stepSeconds.bounds.size()) out << stepSeconds.bounds[b];
+    else out << "+Inf";
+    out << "\"} " << cumulative << "\n";
+  }
+  out << "fluidsim_step_seconds_sum " << stepSeconds.sum.get() << "\n"
+      << "fluidsim_step_seconds_count " << stepSeconds.count.get() << "\n";
+
+  gauge("fluidsim_step_gpu_seconds", "GPU time of the last step", gpuStepSeconds.get());
+  gauge("fluidsim_real_time_delta_seconds", "Simulated time minus the elapsed wall time", realTimeDelta.get());
+  gauge("fluidsim_dt", "Time step of the last step", dt.get());
+  gauge("fluidsim_velocity_max", "Largest velocity component of the last step", vMax.get());
+  gauge("fluidsim_pressure_iterations", "Jacobi iterations of the last pressure solve", pressureIterations.get());
+  gauge("fluidsim_divergence_norm", "Largest absolute divergence of the projected velocities", divergenceNorm.get());
+  gauge("fluidsim_export_queue_depth", "Frames waiting to be exported", exportQueueDepth.get());
+  gauge("fluidsim_texture_bytes", "Bytes of the allocated textures", textureBytes.get());
+  gauge("fluidsim_texture_peak_bytes", "Peak bytes of the allocated textures", peakTextureBytes.get());
+
+#ifndef _WIN32
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  gauge("fluidsim_host_peak_bytes", "Peak resident memory of the process", usage.ru_maxrss * 1024.0);
+#endif
+
+  gpuBytes.render(out, "fluidsim_memory_gpu_bytes", "GPU bytes of the textures and buffers of each tag", "tag");
+  hostBytes.render(out, "fluidsim_memory_host_bytes", "Host bytes of each tag", "tag");
+  passSeconds.render(out, "fluidsim_pass_gpu_seconds", "GPU time of each pass during the last step", "pass");
+
+  return out.str();
+}
+
+Metrics& metrics()
+{
+  static Metrics instance;
+  return instance;
+}
+
+/********** Exporter **********/
+MetricsExporter::MetricsExporter(const ProgramOptions *options)
+  : socketPath(options->metricsSocket), filePath(options->metricsFile), interval(options->metricsInterval)
+{
+  if(socketPath.empty() && filePath.empty()) return;
+
+#ifdef _WIN32
+  std::cout << "The metrics exporter needs UNIX sockets and is disabled on this platform" << std::endl;
+#else
+  if(!socketPath.empty())
+  {
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if(socketPath.size() >= sizeof(address.sun_path))
+    {
+      std::cerr << "Metrics socket path too long: " << socketPath << std::endl;
+      std::exit(1);
+    }
+    std::strcpy(address.sun_path, socketPath.c_str());
+
+    // A socket left by a previous run would make the bind fail
+    unlink(socketPath.c_str());
+
+    listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(listenFd < 0
+        || bind(listenFd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0
+        || listen(listenFd, 4) != 0)
+    {
+      std::cerr << "Cannot listen on the metrics socket " << socketPath << ": " << std::strerror(errno) << std::endl;
+      std::exit(1);
+    }
+
+    std::cout << "Serving the metrics on " << socketPath << std::endl;
+  }
+
+  thread = std::thread(&MetricsExporter::serve, this);
+#endif
+}
+
+MetricsExporter::~MetricsExporter()
+{
+  if(!thread.joinable()) return;
+
+  stopping = true;
+  thread.join();
+
+#ifndef _WIN32
+  if(listenFd >= 0)
+  {
+    close(listenFd);
+    unlink(socketPath.c_str());
+  }
+#endif
+
+  // The last values of the run
+  if(!filePath.empty()) dump();
+}
+
+void MetricsExporter::serve()
+{
+#ifndef _WIN32
+  using clock = std::chrono::steady_clock;
+  const auto period = std::chrono::duration_cast<clock::duration>(std::chrono::duration<float>(std::max(interval, 0.1f)));
+  auto nextDump = clock::now() + period;
+
+  // The poll timeout bounds the time to notice the end of the run
+  while(!stopping)
+  {
+    pollfd fd = { listenFd, POLLIN, 0 };
+    const int ready = listenFd >= 0 ? poll(&fd, 1, 100) : poll(nullptr, 0, 100);
+
+    if(ready > 0 && (fd.revents & POLLIN))
+    {
+      const int client = accept(listenFd, nullptr, nullptr);
+      if(client >= 0)
+      {
+        answer(client);
+        close(client);
+      }
+    }
+
+    if(!filePath.empty() && clock::now() >= nextDump)
+    {
+      dump();
+      nextDump += period;
+    }
+  }
+#endif
+}
+
+void MetricsExporter::answer(const int client) const
+{
+#ifndef _WIN32
+  // A client that never sends its request only holds the exporter for a second
+  timeval timeout = { 1, 0 };
+  setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+  std::string request;
+  char buffer[1024];
+  while(request.find("\r\n\r\n") == std::string::npos && request.size() < 8192)
+  {
+    const ssize_t n = recv(client, buffer, sizeof(buffer), 0);
+    if(n <= 0) break;
+    request.append(buffer, n);
+  }
+
+  std::string status = "200 OK", body;
+  if(request.compare(0, 12, "GET /metrics") == 0) body = metrics().render();
+  else
+  {
+    status = "404 Not Found";
+    body = "Only GET /metrics is served\n";
+  }
+
+  std::ostringstream response;
+  response << "HTTP/1.1 " << status << "\r\n"
+           << "Content-Type: text/plain; version=0.0.4\r\n"
+           << "Content-Length: " << body.size() << "\r\n"
+           << "Connection: close\r\n\r\n"
+           << body;
+
+  const std::string text = response.str();
+  std::size_t sent = 0;
+  while(sent < text.size())
+  {
+    const ssize_t n = send(client, text.data() + sent, text.size() - sent, MSG_NOSIGNAL);
+    if(n <= 0) break;
+    sent += n;
+  }
+#endif
+}
+
+void MetricsExporter::dump() const
+{
+  // Written next to the file and renamed, so a reader never sees half of it
+  const std::string tmpPath = filePath + ".tmp";
+  {
+    std::ofstream file(tmpPath);
+    file << metrics().render();
+  }
+  std::rename(tmpPath.c_str(), filePath.c_str());
+}
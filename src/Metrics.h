@@ -0,0 +1,155 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+/**
+ * @file Metrics.h
+ * @brief Live telemetry of the simulation loop, in the Prometheus text format
+ */
+
+#include "ProgramOptions.h"
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * @class Metrics
+ * @brief Gauges, counters and histograms updated by the simulation loop
+ *
+ * Every update is a relaxed atomic store or add, so recording a metric never
+ * takes a lock nor waits for the exporter. The exporter thread reads the atomics
+ * when it renders the text, which may mix the values of two consecutive steps.
+ */
+class Metrics
+{
+  public:
+    class Gauge
+    {
+      public:
+        void set(const double v) { value.store(v, std::memory_order_relaxed); }
+        double get() const { return value.load(std::memory_order_relaxed); }
+      private:
+        std::atomic<double> value{0.0};
+    };
+
+    class Counter
+    {
+      public:
+        void add(const std::uint64_t n = 1) { value.fetch_add(n, std::memory_order_relaxed); }
+        std::uint64_t get() const { return value.load(std::memory_order_relaxed); }
+      private:
+        std::atomic<std::uint64_t> value{0};
+    };
+
+    /**
+     * Gauges of a family, one per label value. Only the simulation thread adds labels,
+     * and a label is published once its name is written.
+     */
+    class LabeledGauges
+    {
+      public:
+        void set(const std::string& label, const double v);
+        void render(std::ostream& out, const char *name, const char *help, const char *labelName) const;
+      private:
+        struct Slot
+        {
+          std::atomic<bool> used{false};
+          char label[64];
+          Gauge value;
+        };
+
+        std::array<Slot, 64> slots;
+    };
+
+    /**
+     * Histogram with fixed upper bounds, the last bucket being +Inf
+     */
+    class Histogram
+    {
+      public:
+        explicit Histogram(const std::vector<double>& bounds);
+
+        void observe(const double v);
+
+        const std::vector<double> bounds;
+        std::vector<std::atomic<std::uint64_t>> buckets;
+        Gauge sum;
+        Counter count;
+    };
+
+    Metrics();
+
+    /********** Step Loop **********/
+    Counter steps;
+    Histogram stepSeconds;
+    Gauge gpuStepSeconds;
+    Gauge realTimeDelta;
+    Gauge dt;
+
+    /********** Simulation **********/
+    Gauge vMax;
+    Gauge pressureIterations;
+    Gauge divergenceNorm;
+
+    /********** Export and Memory **********/
+    Gauge exportQueueDepth;
+    Gauge textureBytes;
+    Gauge peakTextureBytes;
+    LabeledGauges gpuBytes;
+    LabeledGauges hostBytes;
+
+    /**
+     * GPU time of each pass during the last step
+     */
+    LabeledGauges passSeconds;
+
+    /**
+     * All the metrics in the Prometheus text format
+     */
+    std::string render() const;
+};
+
+/**
+ * Metrics of the process
+ */
+Metrics& metrics();
+
+/**
+ * @class MetricsExporter
+ * @brief Serves the metrics on a UNIX socket and dumps them to a file
+ *
+ * With --metrics-socket, a background thread answers GET /metrics over HTTP on the
+ * socket (e.g. curl --unix-socket sim.sock http://localhost/metrics). With
+ * --metrics-file, the same thread rewrites the file every --metrics-interval seconds.
+ * Nothing is started when both are empty.
+ */
+class MetricsExporter
+{
+  public:
+    explicit MetricsExporter(const ProgramOptions *options);
+    ~MetricsExporter();
+
+    MetricsExporter(const MetricsExporter&) = delete;
+    MetricsExporter& operator=(const MetricsExporter&) = delete;
+
+    /**
+     * Whether the metrics are exported at all
+     */
+    bool enabled() const { return thread.joinable(); }
+  private:
+    void serve();
+    void answer(const int client) const;
+    void dump() const;
+
+    std::string socketPath, filePath;
+    float interval;
+    int listenFd = -1;
+    std::atomic<bool> stopping{false};
+    std::thread thread;
+};
+
+#endif //METRICS_H
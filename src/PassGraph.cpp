@@ -0,0 +1,48 @@
+#include "PassGraph.h"
+
+#include <algorithm>
+
+static bool intersects(const std::vector<GLuint>& a, const std::vector<GLuint>& b)
+{
+  for(GLuint tex : a)
+    if(std::find(b.begin(), b.end(), tex) != b.end()) return true;
+
+  return false;
+}
+
+void PassGraph::add(const std::string& name, const std::vector<GLuint>& reads, const std::vector<GLuint>& writes, std::function<void()> run)
+{
+  Pass pass { name, reads, writes, run, 0 };
+
+  for(const Pass& other : passes)
+  {
+    const bool hazard = intersects(pass.reads, other.writes)
+                     || intersects(pass.writes, other.reads)
+                     || intersects(pass.writes, other.writes);
+    if(hazard) pass.level = std::max(pass.level, other.level + 1);
+  }
+
+  passes.push_back(pass);
+}
+
+std::vector<std::string> PassGraph::order() const
+{
+  std::vector<const Pass*> sorted;
+  for(const Pass& pass : passes) sorted.push_back(&pass);
+
+  // The stable sort keeps the recording order within a level
+  std::stable_sort(sorted.begin(), sorted.end(), [](const Pass *a, const Pass *b) { return a->level < b->level; });
+
+  std::vector<std::string> names;
+  for(const Pass *pass : sorted) names.push_back(pass->name);
+  return names;
+}
+
+void PassGraph::execute()
+{
+  std::stable_sort(passes.begin(), passes.end(), [](const Pass& a, const Pass& b) { return a.level < b.level; });
+
+  for(const Pass& pass : passes) pass.run();
+
+  passes.clear();
+}
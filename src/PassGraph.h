@@ -0,0 +1,58 @@
+#ifndef PASSGRAPH_H
+#define PASSGRAPH_H
+
+/**
+ * @file PassGraph.h
+ * @brief Ordering of the passes of a simulation step from their fields
+ */
+
+#include "GLUtils.h"
+
+#include <functional>
+#include <string>
+#include <vector>
+
+/**
+ * @class PassGraph
+ * @brief Records the passes of a step with the fields they read and write
+ *
+ * A pass depends on every earlier pass it has a hazard with: it reads a field
+ * they write, or writes a field they read or write. execute() runs the passes
+ * level by level, where the level of a pass is one more than the level of its
+ * last dependency. Independent passes thus end up next to each other and the
+ * factory does not need a barrier between their dispatches.
+ */
+class PassGraph
+{
+  public:
+    /**
+     * Records a pass
+     * @param name name of the pass
+     * @param reads the fields the pass reads
+     * @param writes the fields the pass writes, including the fields updated in place
+     * @param run the work of the pass
+     */
+    void add(const std::string& name, const std::vector<GLuint>& reads, const std::vector<GLuint>& writes, std::function<void()> run);
+
+    /**
+     * Runs the recorded passes in dependency order and clears the graph
+     */
+    void execute();
+
+    /**
+     * Names of the passes in their execution order, for debugging
+     */
+    std::vector<std::string> order() const;
+  private:
+    struct Pass
+    {
+      std::string name;
+      std::vector<GLuint> reads, writes;
+      std::function<void()> run;
+      unsigned level;
+    };
+
+    std::vector<Pass> passes;
+};
+
+#endif //PASSGRAPH_H
@@ -0,0 +1,158 @@
+#include "PressureSolver.h"
+#include "SimulationFactory.h"
+
+#include <algorithm>
+
+/********** Full Resolution Jacobi **********/
+JacobiSolver::JacobiSolver(SimulationFactory& sFact, ProgramOptions *options)
+  : PressureSolver(sFact, options)
+{
+}
+
+void JacobiSolver::project(const GLuint *velocities)
+{
+  const unsigned w = options->simWidth, h = options->simHeight;
+  const GLuint divergence = sFact.pool.acquire(w, h, GL_R32F);
+  GLuint pressure[2] = { sFact.pool.acquire(w, h, GL_R32F), sFact.pool.acquire(w, h, GL_R32F) };
+
+  sFact.divergenceCurl(velocities[0], divergence);
+
+  sFact.clear(pressure[0]);
+  for(unsigned k = 0; k < options->jacobiIterations; ++k)
+  {
+    sFact.solvePressure(divergence, pressure[0], pressure[1]);
+    std::swap(pressure[0], pressure[1]);
+  }
+
+  sFact.pressureProjection(pressure[0], velocities[0], velocities[1]);
+
+  sFact.pool.release(divergence);
+  sFact.pool.release(pressure[0]);
+  sFact.pool.release(pressure[1]);
+}
+
+/********** Red-Black Jacobi **********/
+RedBlackSolver::RedBlackSolver(SimulationFactory& sFact, ProgramOptions *options)
+  : PressureSolver(sFact, options),
+    packedWidth((options->simWidth + 1) / 2),
+    packedHeight((options->simHeight + 1) / 2)
+{
+}
+
+void RedBlackSolver::project(const GLuint *velocities)
+{
+  const GLuint divergence = sFact.pool.acquire(packedWidth, packedHeight);
+  const GLuint pressure = sFact.pool.acquire(packedWidth, packedHeight);
+
+  sFact.divergenceRB(velocities[0], divergence);
+
+  sFact.clearRB(pressure);
+
+  sFact.jacobiRB(divergence, pressure, options->jacobiIterations);
+
+  sFact.pressureProjectionRB(pressure, velocities[0], velocities[1]);
+
+  sFact.pool.release(divergence);
+  sFact.pool.release(pressure);
+}
+
+/********** Mixed Precision Red-Black Jacobi **********/
+MixedPrecisionSolver::MixedPrecisionSolver(SimulationFactory& sFact, ProgramOptions *options)
+  : PressureSolver(sFact, options),
+    packedWidth((options->simWidth + 1) / 2),
+    packedHeight((options->simHeight + 1) / 2)
+{
+}
+
+void MixedPrecisionSolver::project(const GLuint *velocities)
+{
+  const GLuint divergence = sFact.pool.acquire(packedWidth, packedHeight, GL_RGBA32F);
+  GLuint pressure[2] = { sFact.pool.acquire(packedWidth, packedHeight, GL_RGBA32F),
+                         sFact.pool.acquire(packedWidth, packedHeight, GL_RGBA32F) };
+  const GLuint residual = sFact.pool.acquire(packedWidth, packedHeight);
+  const GLuint correction = sFact.pool.acquire(packedWidth, packedHeight);
+
+  sFact.divergenceRB(velocities[0], divergence);
+
+  // The pressure starts at zero, so the first residual is the divergence itself
+  sFact.clearRB(pressure[0]);
+  GLuint rhs = divergence;
+
+  const unsigned passes = std::max(options->refinementPasses, 1u);
+  for(unsigned k = 0; k < passes; ++k)
+  {
+    const unsigned iterations = options->jacobiIterations / passes + (k < options->jacobiIterations % passes ? 1 : 0);
+    sFact.clearRB(correction);
+    sFact.jacobiRB(rhs, correction, iterations);
+
+    // Adds the correction and computes the residual of the next pass
+    sFact.residualRB(pressure[0], correction, divergence, pressure[1], residual);
+    std::swap(pressure[0], pressure[1]);
+    rhs = residual;
+  }
+
+  sFact.pressureProjectionRB(pressure[0], velocities[0], velocities[1]);
+
+  sFact.pool.release(divergence);
+  sFact.pool.release(pressure[0]);
+  sFact.pool.release(pressure[1]);
+  sFact.pool.release(residual);
+  sFact.pool.release(correction);
+}
+
+/********** CPU Red-Black Jacobi **********/
+CPUSolver::CPUSolver(SimulationFactory& sFact, ProgramOptions *options)
+  : PressureSolver(sFact, options),
+    velocities(options->simWidth, options->simHeight, 2),
+    divergence((options->simWidth + 1) / 2, (options->simHeight + 1) / 2),
+    pressure((options->simWidth + 1) / 2, (options->simHeight + 1) / 2)
+{
+  trackHostBytes("pressure solver", hostBytes());
+}
+
+CPUSolver::~CPUSolver()
+{
+  trackHostBytes("pressure solver", - hostBytes());
+}
+
+long long CPUSolver::hostBytes() const
+{
+  return sizeof(std::uint16_t) * (velocities.texels.size() + divergence.texels.size() + pressure.texels.size());
+}
+
+void CPUSolver::project(const GLuint *velocitiesTextures)
+{
+  // The readback waits for the pending dispatches
+  sFact.flushBarriers();
+  readTextureHalf(velocitiesTextures[0], velocities);
+
+  divRB(velocities, divergence);
+
+  std::fill(pressure.texels.begin(), pressure.texels.end(), 0);
+  for(unsigned k = 0; k < options->jacobiIterations; ++k)
+  {
+    jacobiBlack(divergence, pressure, options->simWidth, options->simHeight);
+    jacobiRed(divergence, pressure, options->simWidth, options->simHeight);
+  }
+
+  pressureProjectionRB(pressure, velocities);
+
+  sFact.uploadHalf(velocitiesTextures[1], velocities);
+}
+
+std::unique_ptr<PressureSolver> createPressureSolver(const PressureSolverType type, SimulationFactory& sFact, ProgramOptions *options)
+{
+  switch(type)
+  {
+    case JACOBI:
+      return std::make_unique<JacobiSolver>(sFact, options);
+    case RED_BLACK:
+      return std::make_unique<RedBlackSolver>(sFact, options);
+    case MIXED:
+      return std::make_unique<MixedPrecisionSolver>(sFact, options);
+    case CPU:
+      return std::make_unique<CPUSolver>(sFact, options);
+  }
+
+  return nullptr;
+}
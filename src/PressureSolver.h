@@ -0,0 +1,115 @@
+#ifndef PRESSURESOLVER_H
+#define PRESSURESOLVER_H
+
+/**
+ * @file PressureSolver.h
+ * @brief Pressure projections shared by the simulations
+ */
+
+#include "GLUtils.h"
+#include "ProgramOptions.h"
+#include "CPUKernels.h"
+
+#include <memory>
+
+class SimulationFactory;
+
+/**
+ * @class PressureSolver
+ * @brief Makes a velocity field divergence free
+ *
+ * The simulations call SimulationFactory::project, which forwards to the solver
+ * selected by --pressure-solver. A solver only uses the kernels and the texture
+ * pool of the factory, so a new solver works for every simulation.
+ */
+class PressureSolver
+{
+  public:
+    PressureSolver(SimulationFactory& sFact, ProgramOptions *options)
+      : sFact(sFact), options(options) {}
+
+    virtual ~PressureSolver() = default;
+
+    /**
+     * Projects velocities[0] into velocities[1]
+     */
+    virtual void project(const GLuint *velocities) = 0;
+  protected:
+    SimulationFactory& sFact;
+    ProgramOptions *options;
+};
+
+/**
+ * @class JacobiSolver
+ * @brief Jacobi iterations on the full resolution grid, ping-ponging two R32F pressures
+ */
+class JacobiSolver : public PressureSolver
+{
+  public:
+    JacobiSolver(SimulationFactory& sFact, ProgramOptions *options);
+
+    void project(const GLuint *velocities) override;
+};
+
+/**
+ * @class RedBlackSolver
+ * @brief Red-Black Jacobi iterations on the packed half resolution textures
+ */
+class RedBlackSolver : public PressureSolver
+{
+  public:
+    RedBlackSolver(SimulationFactory& sFact, ProgramOptions *options);
+
+    void project(const GLuint *velocities) override;
+  private:
+    unsigned packedWidth, packedHeight;
+};
+
+/**
+ * @class MixedPrecisionSolver
+ * @brief Red-Black Jacobi with fp32 iterative refinement
+ *
+ * The pressure and the divergence are kept in RGBA32F. Each refinement pass computes
+ * the residual of the pressure in fp32 and solves for a correction with fp16 Red-Black
+ * sweeps, which the next pass adds to the pressure. The Jacobi iterations are split
+ * between the passes, so the cost stays the one of the fp16 sweeps plus one residual
+ * pass each, and the accuracy is no longer bounded by the fp16 pressure.
+ */
+class MixedPrecisionSolver : public PressureSolver
+{
+  public:
+    MixedPrecisionSolver(SimulationFactory& sFact, ProgramOptions *options);
+
+    void project(const GLuint *velocities) override;
+  private:
+    unsigned packedWidth, packedHeight;
+};
+
+/**
+ * @class CPUSolver
+ * @brief Red-Black Jacobi on the CPU, with the fields in half precision
+ *
+ * The velocities are read back in half precision, and the divergence, the pressure
+ * and the projection run through the CPU kernels of CPUKernels.h with the boundaries
+ * of the shaders. The fields stay in half like the GL_RGBA16F textures of the GPU path,
+ * which halves the memory traffic and the memory of the large grids.
+ */
+class CPUSolver : public PressureSolver
+{
+  public:
+    CPUSolver(SimulationFactory& sFact, ProgramOptions *options);
+    ~CPUSolver();
+
+    void project(const GLuint *velocities) override;
+  private:
+    long long hostBytes() const;
+
+    HalfImage velocities, divergence, pressure;
+};
+
+/**
+ * Solver of the given type
+ */
+std::unique_ptr<PressureSolver> createPressureSolver(const PressureSolverType type, SimulationFactory& sFact, ProgramOptions *options);
+
+#endif //PRESSURESOLVER_H
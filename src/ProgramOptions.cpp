@@ -32,6 +32,92 @@ std::istream& operator>>(std::istream& is, SimulationType& type)
   return is;
 }
 
+std::ostream& operator<<(std::ostream& os, const Interpolation& interpolation)
+{
+  switch(interpolation)
+  {
+    case EXACT:
+      os << "exact";
+      break;
+    case FAST:
+      os << "fast";
+      break;
+  }
+
+  return os;
+}
+
+std::istream& operator>>(std::istream& is, Interpolation& interpolation)
+{
+  std::string token;
+  is >> token;
+  if(token == "exact") { interpolation = EXACT; return is; }
+  if(token == "fast")  { interpolation = FAST; return is; }
+
+  throw std::invalid_argument("bad interpolation");
+  return is;
+}
+
+std::ostream& operator<<(std::ostream& os, const PressureSolverType& solver)
+{
+  switch(solver)
+  {
+    case JACOBI:
+      os << "jacobi";
+      break;
+    case RED_BLACK:
+      os << "red-black";
+      break;
+    case MIXED:
+      os << "mixed";
+      break;
+    case CPU:
+      os << "cpu";
+      break;
+  }
+
+  return os;
+}
+
+std::istream& operator>>(std::istream& is, PressureSolverType& solver)
+{
+  std::string token;
+  is >> token;
+  if(token == "jacobi")    { solver = JACOBI; return is; }
+  if(token == "red-black") { solver = RED_BLACK; return is; }
+  if(token == "mixed")     { solver = MIXED; return is; }
+  if(token == "cpu")       { solver = CPU; return is; }
+
+  throw std::invalid_argument("bad pressure solver");
+  return is;
+}
+
+std::ostream& operator<<(std::ostream& os, const MemoryPolicy& policy)
+{
+  switch(policy)
+  {
+    case FAIL:
+      os << "fail";
+      break;
+    case DOWNGRADE:
+      os << "downgrade";
+      break;
+  }
+
+  return os;
+}
+
+std::istream& operator>>(std::istream& is, MemoryPolicy& policy)
+{
+  std::string token;
+  is >> token;
+  if(token == "fail")      { policy = FAIL; return is; }
+  if(token == "downgrade") { policy = DOWNGRADE; return is; }
+
+  throw std::invalid_argument("bad memory policy");
+  return is;
+}
+
 ProgramOptions parseOptions(int argc, char* argv[])
 {
   namespace po = boost::program_options;
@@ -43,20 +129,55 @@ ProgramOptions parseOptions(int argc, char* argv[])
     ("windowWidth", po::value<unsigned>(&options.windowWidth)->default_value(800), "window width")
     ("windowHeight", po::value<unsigned>(&options.windowHeight)->default_value(800), "window height")
     ("exportImages", po::value<bool>(&options.exportImages)->default_value(false), "export simulation to a set of PNG files")
+    ("offscreen", po::value<bool>(&options.offscreen)->default_value(false), "run with a hidden window and without vsync")
+    ("sim-thread", po::value<bool>(&options.simThread)->default_value(false), "run the simulation on its own thread, the window showing its latest frame at vsync")
+    ("gl-debug", po::value<bool>(&options.debugContext)->default_value(true), "request an OpenGL debug context")
   ;
 
   po::options_description poSim("Simulation options");
   poSim.add_options()
     ("simType,s", po::value<SimulationType>(&options.simType)->default_value(SPLATS), "type of simulation (splats, smoke)")
     ("deltaTime,t", po::value<float>(&options.dt)->default_value(0.1f), "time step for the simulation")
-    ("simWidth", po::value<unsigned>(&options.simWidth)->default_value(1024), "simulation width (must be a power of 2)")
-    ("simHeight", po::value<unsigned>(&options.simHeight)->default_value(1024), "simulation height (must be a power of 2)")
+    ("fixed-dt", po::value<float>(&options.fixedDt)->default_value(0.0f), "simulated time of each step, run in sub-steps of at most --cfl cells (0: a single step of the adaptive time step)")
+    ("cfl", po::value<float>(&options.cfl)->default_value(5.0f), "largest distance in cells travelled by the fluid during a step or sub-step")
+    ("steps-per-frame", po::value<unsigned>(&options.stepsPerFrame)->default_value(1), "steps between two displayed and exported frames")
+    ("simWidth", po::value<unsigned>(&options.simWidth)->default_value(1024), "simulation width")
+    ("simHeight", po::value<unsigned>(&options.simHeight)->default_value(1024), "simulation height")
+    ("pressure-solver", po::value<PressureSolverType>(&options.pressureSolver)->default_value(RED_BLACK), "pressure solver of every simulation (jacobi: full resolution Jacobi, red-black: Red-Black Jacobi on packed textures, mixed: Red-Black Jacobi refined with fp32 residuals, cpu: Red-Black Jacobi on the CPU in half precision)")
     ("jacobi-iterations", po::value<unsigned>(&options.jacobiIterations)->default_value(50), "number of iterations for the Jacobi method")
+    ("refinement-passes", po::value<unsigned>(&options.refinementPasses)->default_value(3), "number of fp32 residual passes of the mixed solver, which split the Jacobi iterations between them")
+    ("jacobi-sweeps", po::value<unsigned>(&options.jacobiSweeps)->default_value(4), "number of Red-Black iterations per dispatch, run in shared memory (1 uses a dispatch per color)")
     ("mc-revert", po::value<float>(&options.mcRevert)->default_value(0.05), "revert parameter for the maccormack advection scheme")
+    ("interpolation", po::value<Interpolation>(&options.interpolation)->default_value(EXACT), "bilinear interpolation of the advection (exact: fp32 weights, fast: hardware filtering)")
+    ("active-tiles", po::value<bool>(&options.activeTiles)->default_value(false), "only run the advection and projection kernels on the tiles around the non-empty regions (smoke)")
+    ("sparse-textures", po::value<bool>(&options.sparseTextures)->default_value(false), "only commit the memory pages of the fields around the non-empty regions (smoke, needs ARB_sparse_texture2)")
+    ("memory-budget", po::value<unsigned>(&options.memoryBudget)->default_value(0), "GPU memory budget in MB of the textures and buffers (0: no budget)")
+    ("memory-policy", po::value<MemoryPolicy>(&options.memoryPolicy)->default_value(FAIL), "when the estimated memory is over the budget (fail: exit at startup, downgrade: 16 bits pressure solver, then lower resolution)")
+  ;
+
+  po::options_description poInput("Initial conditions options");
+  poInput.add_options()
+    ("init-velocities", po::value<std::string>(&options.initVelocities)->default_value(""), "field file of the initial velocities (see field_convert)")
+    ("init-density", po::value<std::string>(&options.initDensity)->default_value(""), "field file of the initial density")
+    ("init-temperature", po::value<std::string>(&options.initTemperature)->default_value(""), "field file of the initial temperature (smoke, clouds)")
+    ("obstacles", po::value<std::string>(&options.obstacles)->default_value(""), "field file of the obstacle mask, solid where over 0.5")
+  ;
+
+  po::options_description poTuning("Tuning options");
+  poTuning.add_options()
+    ("autotune", po::value<bool>(&options.autotune)->default_value(false), "measure the best work group size of each kernel for this device and grid size")
+    ("workgroup-cache", po::value<std::string>(&options.workGroupCache)->default_value("workgroup_sizes.txt"), "file storing the measured work group sizes")
+  ;
+
+  po::options_description poMetrics("Metrics options");
+  poMetrics.add_options()
+    ("metrics-socket", po::value<std::string>(&options.metricsSocket)->default_value(""), "UNIX socket serving the metrics over HTTP in the Prometheus text format (empty: disabled)")
+    ("metrics-file", po::value<std::string>(&options.metricsFile)->default_value(""), "file the metrics are periodically written to (empty: disabled)")
+    ("metrics-interval", po::value<float>(&options.metricsInterval)->default_value(5.0f), "seconds between two writes of the metrics file")
   ;
 
   po::options_description po_options("sim [options]");
-  po_options.add(poWindow).add(poSim).add_options()
+  po_options.add(poWindow).add(poSim).add(poInput).add(poTuning).add(poMetrics).add_options()
     ("help,h", "display this message")
   ;
 
@@ -7,6 +7,8 @@
 #include <boost/program_options/parsers.hpp>
 #include <boost/program_options/errors.hpp>
 
+#include <string>
+
 enum SimulationType
 {
   SPLATS,
@@ -17,17 +19,72 @@ enum SimulationType
 std::ostream& operator<<(std::ostream& os, const SimulationType& type);
 std::istream& operator>>(std::istream& os, SimulationType& type);
 
+enum Interpolation
+{
+  EXACT,
+  FAST
+};
+
+std::ostream& operator<<(std::ostream& os, const Interpolation& interpolation);
+std::istream& operator>>(std::istream& os, Interpolation& interpolation);
+
+enum PressureSolverType
+{
+  JACOBI,
+  RED_BLACK,
+  MIXED,
+  CPU
+};
+
+std::ostream& operator<<(std::ostream& os, const PressureSolverType& solver);
+std::istream& operator>>(std::istream& os, PressureSolverType& solver);
+
+enum MemoryPolicy
+{
+  FAIL,
+  DOWNGRADE
+};
+
+std::ostream& operator<<(std::ostream& os, const MemoryPolicy& policy);
+std::istream& operator>>(std::istream& os, MemoryPolicy& policy);
+
 struct ProgramOptions
 {
   unsigned windowWidth, windowHeight;
 
   SimulationType simType;
   unsigned simWidth, simHeight;
+  PressureSolverType pressureSolver;
   unsigned jacobiIterations;
+  unsigned jacobiSweeps;
+  unsigned refinementPasses;
   float dt;
+  float fixedDt;
+  float cfl;
+  unsigned stepsPerFrame;
   float mcRevert;
+  Interpolation interpolation;
+  bool activeTiles;
+  bool sparseTextures;
+  unsigned memoryBudget;
+  MemoryPolicy memoryPolicy;
+
+  std::string initVelocities;
+  std::string initDensity;
+  std::string initTemperature;
+  std::string obstacles;
 
   bool exportImages;
+  bool offscreen;
+  bool simThread;
+  bool debugContext;
+
+  bool autotune;
+  std::string workGroupCache;
+
+  std::string metricsSocket;
+  std::string metricsFile;
+  float metricsInterval;
 };
 
 ProgramOptions parseOptions(int argc, char* argv[]);
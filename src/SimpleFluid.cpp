@@ -1,5 +1,7 @@
 #include "SimpleFluid.h"
 #include "GLUtils.h"
+#include "Metrics.h"
+#include "PassGraph.h"
 
 #include <string>
 #include <sstream>
@@ -13,56 +15,37 @@ float rd()
 
 SimpleFluid::~SimpleFluid()
 {
-  glDeleteTextures(4, velocitiesTexture);
-  glDeleteTextures(4, density);
-  glDeleteTextures(1, &divergenceCurlTexture);
-  glDeleteTextures(1, &divRBTexture);
-  glDeleteTextures(1, &pressureRBTexture);
+  deleteTextures(2, velocitiesTexture);
+  deleteTextures(2, density);
 }
 
 void SimpleFluid::Init()
 {
   /********** Texture Initilization **********/
-  auto f = [](unsigned, unsigned)
-      {
-        return std::make_tuple(0.0f, 0.0f,
-                               0.0f, 0.0f);
-      };
+  // Only the state lives here, the intermediate fields of each pass come from the factory pool.
+  // The textures start at zero.
+  density[0] = createTexture2D(options->simWidth, options->simHeight, GL_RGBA16F, "density");
+  density[1] = createTexture2D(options->simWidth, options->simHeight, GL_RGBA16F, "density");
 
-  density[0] = createTexture2D(options->simWidth, options->simHeight);
-  density[1] = createTexture2D(options->simWidth, options->simHeight);
-  density[2] = createTexture2D(options->simWidth, options->simHeight);
-  density[3] = createTexture2D(options->simWidth, options->simHeight);
-  fillTextureWithFunctor(density[0], options->simWidth, options->simHeight, f);
+  velocitiesTexture[0] = createTexture2D(options->simWidth, options->simHeight, GL_RG16F, "velocities");
+  velocitiesTexture[1] = createTexture2D(options->simWidth, options->simHeight, GL_RG16F, "velocities");
 
-  velocitiesTexture[0] = createTexture2D(options->simWidth, options->simHeight);
-  velocitiesTexture[1] = createTexture2D(options->simWidth, options->simHeight);
-  velocitiesTexture[2] = createTexture2D(options->simWidth, options->simHeight);
-  velocitiesTexture[3] = createTexture2D(options->simWidth, options->simHeight);
-  fillTextureWithFunctor(velocitiesTexture[0], options->simWidth, options->simHeight, f);
-
-  divergenceCurlTexture = createTexture2D(options->simWidth, options->simHeight);
-  fillTextureWithFunctor(divergenceCurlTexture, options->simWidth, options->simHeight, f);
-
-  divRBTexture = createTexture2D(options->simWidth / 2, options->simHeight / 2);
-  fillTextureWithFunctor(divRBTexture, options->simWidth / 2, options->simHeight / 2, f);
-
-  pressureRBTexture = createTexture2D(options->simWidth / 2, options->simHeight / 2);
-
-  unsigned x = 300u; unsigned y = 512u;
+  // Initial splats, placed relative to the grid size (300 and 700 on a 1024 grid)
+  unsigned x = options->simWidth * 300u / 1024u; unsigned y = options->simHeight / 2u;
   sFact.addSplat(velocitiesTexture[READ], std::make_tuple(x, y), std::make_tuple(80.0f, 7.0f, 0.0f), 1.0f);
   sFact.addSplat(density[READ], std::make_tuple(x, y), std::make_tuple(75.0 / 255.0, 89.0 / 255.0, 1.0), 2.5f);
 
-  x = 700u; y = 512u;
+  x = options->simWidth * 700u / 1024u;
   sFact.addSplat(velocitiesTexture[READ], std::make_tuple(x, y), std::make_tuple(- 80.0f, - 7.0f, 0.0f), 1.0f);
   sFact.addSplat(density[READ], std::make_tuple(x, y), std::make_tuple(1.0, 151.0 / 255.0, 60.0 / 255.0), 2.5f);
+  sFact.flushBarriers();
 }
 
 void SimpleFluid::AddSplat()
 {
-  glfwGetCursorPos(handler->window, &sOriginX, &sOriginY);
-  sOriginX = (double) options->simWidth * sOriginX / (double) options->windowWidth;
-  sOriginY = (double) options->simHeight * (1.0 - sOriginY / (double) options->windowHeight);
+  auto [cursorX, cursorY] = handler->cursor();
+  sOriginX = (double) options->simWidth * cursorX;
+  sOriginY = (double) options->simHeight * cursorY;
 
   addSplat = true;
 }
@@ -77,6 +60,11 @@ void SimpleFluid::RemoveSplat()
   addSplat = false;
 }
 
+std::map<std::string, GLuint> SimpleFluid::Fields() const
+{
+  return { { "velocities", velocitiesTexture[READ] }, { "density", density[READ] } };
+}
+
 void SimpleFluid::Update()
 {
   /********** Adding Splat *********/
@@ -93,10 +81,9 @@ void SimpleFluid::Update()
   if(addSplat)
   {
     float vScale = 1.0f;
-    double sX, sY;
-    glfwGetCursorPos(handler->window, &sX, &sY);
-    sX = (double) options->simWidth * sX / (double) options->windowWidth;
-    sY = (double) options->simHeight * (1.0 - sY / (double) options->windowHeight);
+    auto [cursorX, cursorY] = handler->cursor();
+    double sX = (double) options->simWidth * cursorX;
+    double sY = (double) options->simHeight * cursorY;
     sFact.addSplat(velocitiesTexture[READ], std::make_tuple(sX, sY), std::make_tuple(vScale * (sX - sOriginX), vScale * (sY - sOriginY), 0.0f), 40.0f);
     sFact.addSplat(density[READ], std::make_tuple(sX, sY), std::make_tuple(rd(), rd(), rd()), 1.0f);
 
@@ -104,22 +91,34 @@ void SimpleFluid::Update()
     sOriginY = sY;
   }
 
-  float vMax = sFact.maxReduce(velocitiesTexture[READ]);
-  if(vMax > 1e-10f) options->dt = 5.0f / vMax;
+  // With --fixed-dt, advanceSimulation() sets the time step
+  if(options->fixedDt <= 0.0f)
+  {
+    float vMax = sFact.maxReduce(velocitiesTexture[READ]);
+    metrics().vMax.set(vMax);
+    if(vMax > 1e-10f) options->dt = options->cfl / vMax;
+  }
+
+  /********** Step Passes **********/
+  // The advected velocities end up in vel[1], and the projection writes them back to vel[0]
+  PassGraph graph;
+  const GLuint vel[2] = { velocitiesTexture[READ], velocitiesTexture[WRITE] };
+  const GLuint proj[2] = { vel[1], vel[0] };
+  const GLuint den[2] = { density[READ], density[WRITE] };
 
   /********** Convection **********/
-  //sFact.RKAdvect(velocitiesTexture[READ], velocitiesTexture[READ], velocitiesTexture[WRITE], options->dt);
-  sFact.mcAdvect(velocitiesTexture[READ], velocitiesTexture);
-  std::swap(velocitiesTexture[0], velocitiesTexture[3]);
+  graph.add("advectVelocities", { vel[0] }, { vel[1] }, [this, vel]() { sFact.mcAdvect(vel[0], vel); });
 
   /********** Field Advection **********/
-  //sFact.RKAdvect(velocitiesTexture[READ], density[READ], density[WRITE], options->dt);
-  sFact.mcAdvect(velocitiesTexture[READ], density);
-  std::swap(density[0], density[3]);
+  graph.add("advectDensity", { vel[1], den[0] }, { den[1] }, [this, vel, den]() { sFact.mcAdvect(vel[1], den); });
+
+  /********** Pressure Projection *********/
+  graph.add("projection", { proj[0] }, { proj[1] }, [this, proj]() { sFact.project(proj); });
+
+  graph.execute();
+  sFact.flushBarriers();
 
-  /********** Red-Black Jacobi for the pressure projection *********/
-  sFact.RBMethod(velocitiesTexture, divRBTexture, pressureRBTexture);
-  std::swap(velocitiesTexture[READ], velocitiesTexture[WRITE]);
+  std::swap(density[READ], density[WRITE]);
 
   /********** Updating the shared texture **********/
   shared_texture = density[READ];
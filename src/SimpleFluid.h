@@ -18,6 +18,8 @@ class SimpleFluid : public SimulationBase
     void AddSplat() override;
     void AddMultipleSplat(const int nb) override;
     void RemoveSplat() override;
+
+    std::map<std::string, GLuint> Fields() const override;
   private:
     int READ = 0, WRITE = 1;
 
@@ -25,11 +27,8 @@ class SimpleFluid : public SimulationBase
     double sOriginX, sOriginY;
     int nbSplat = 0;
 
-    GLuint velocitiesTexture[4];
-    GLuint density[4];
-    GLuint divRBTexture;
-    GLuint pressureRBTexture;
-    GLuint divergenceCurlTexture;
+    GLuint velocitiesTexture[2];
+    GLuint density[2];
 };
 
 #endif //SIMPLEFLUID_H
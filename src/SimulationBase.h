@@ -18,6 +18,9 @@
 #include "GLFWHandler.h"
 #include "SimulationFactory.h"
 
+#include <map>
+#include <string>
+
 /**
  * @class SimulationBase
  * @brief The pure virtual class of the simulation
@@ -64,6 +67,14 @@ class SimulationBase
      */
     virtual void RemoveSplat() = 0;
 
+    /**
+     * Named textures holding the current state of the simulation
+     */
+    virtual std::map<std::string, GLuint> Fields() const
+    {
+      return { { "display", shared_texture } };
+    }
+
     /**
      * The program options
      */
@@ -1,33 +1,50 @@
 #include "SimulationFactory.h"
+#include "WorkGroupTuner.h"
 #include "GLUtils.h"
+#include "Metrics.h"
 
 #include <iostream>
+#include <sstream>
+#include <algorithm>
 #include <cmath>
+#include <limits>
+#include <numeric>
 
-/********** Utility Functions **********/
-void bindImageTexture(const GLuint binding, const GLuint tex)
-{
-  glBindImageTexture(binding, tex, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA16F);
-}
+// Cells per texel of the active region along each axis, dilation of the active blocks
+// in texels (more than the distance covered by the advection in one step) and smallest
+// magnitude of a field that is not negligible
+static const unsigned activeCellSize = 8;
+static const int activeMargin = 2;
+static const float activityThreshold = 1e-3f;
 
-void bindTexture(const GLuint binding, const GLuint tex)
+// Smallest contribution of a splat that is added to a field
+static const float splatThreshold = 1e-4f;
+
+// Steps after which the residency readback of a step is waited for. The units get a guard band
+// covering the growth of the region over these steps.
+static const unsigned residencyLatency = 2;
+
+// A splat in the std430 queue of addSmokeSpot.comp
+struct GPUSplat
 {
-  glActiveTexture(GL_TEXTURE0 + binding);
-  glBindTexture(GL_TEXTURE_2D, tex);
-}
+  GLint x, y, field;
+  GLfloat intensity, r, g, b, radius;
+};
 
+/********** Utility Functions **********/
 void fillTextureWithFunctor(GLuint tex,
     const unsigned width,
     const unsigned height,
     std::function<std::tuple<float, float, float, float>(unsigned, unsigned)> f)
 {
-  float *data = new float[4 * width * height];
+  std::vector<float> data(4 * static_cast<std::size_t>(width) * height);
 
-  for(unsigned x = 0; x < width; ++x)
+  // Row major, like the texture
+  for(unsigned y = 0; y < height; ++y)
   {
-    for(unsigned y = 0; y < height; ++y)
+    for(unsigned x = 0; x < width; ++x)
     {
-      const unsigned pos = 4 * (y * width + x);
+      const std::size_t pos = 4 * (static_cast<std::size_t>(y) * width + x);
 
       auto [r, g, b, a] = f(x, y);
 
@@ -38,200 +55,735 @@ void fillTextureWithFunctor(GLuint tex,
     }
   }
 
+  // Writing into the existing storage keeps the format the texture was created with
   glBindTexture(GL_TEXTURE_2D, tex);
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, width, height, 0, GL_RGBA, GL_FLOAT, data);
-
-  delete [] data;
+  glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGBA, GL_FLOAT, data.data());
 }
 
 SimulationFactory::SimulationFactory(ProgramOptions *options)
   : options(options),
-    globalSizeX(options->simWidth / 32),
-    globalSizeY(options->simHeight / 32)
-{
-  copyProgram = compileAndLinkShader("shaders/simulation/copy.comp", GL_COMPUTE_SHADER);
-  maxReduceProgram = compileAndLinkShader("shaders/simulation/maxReduce.comp", GL_COMPUTE_SHADER);
-  addSmokeSpotProgram = compileAndLinkShader("shaders/simulation/addSmokeSpot.comp", GL_COMPUTE_SHADER);
-  maccormackProgram = compileAndLinkShader("shaders/simulation/mccormack.comp", GL_COMPUTE_SHADER);
-  RKProgram = compileAndLinkShader("shaders/simulation/RKAdvect.comp", GL_COMPUTE_SHADER);
-  divCurlProgram = compileAndLinkShader("shaders/simulation/divCurl.comp", GL_COMPUTE_SHADER);
-  divRBProgram = compileAndLinkShader("shaders/simulation/divRB.comp", GL_COMPUTE_SHADER);
-  jacobiProgram = compileAndLinkShader("shaders/simulation/jacobi.comp", GL_COMPUTE_SHADER);
-  jacobiBlackProgram = compileAndLinkShader("shaders/simulation/jacobiBlack.comp", GL_COMPUTE_SHADER);
-  jacobiRedProgram = compileAndLinkShader("shaders/simulation/jacobiRed.comp", GL_COMPUTE_SHADER);
-  pressureProjectionProgram = compileAndLinkShader("shaders/simulation/pressure_projection.comp", GL_COMPUTE_SHADER);
-  pressureProjectionRBProgram = compileAndLinkShader("shaders/simulation/pressureProjectionRB.comp", GL_COMPUTE_SHADER);
-  applyVorticityProgram = compileAndLinkShader("shaders/simulation/applyVorticity.comp", GL_COMPUTE_SHADER);
-  applyBuoyantForceProgram = compileAndLinkShader("shaders/simulation/buoyantForce.comp", GL_COMPUTE_SHADER);
-  waterContinuityProgram = compileAndLinkShader("shaders/simulation/waterContinuity.comp", GL_COMPUTE_SHADER);
-
-  /********** Textures for reduce **********/
-  int nb = static_cast<int>(std::log(static_cast<double>(options->simWidth)) / std::log(2.0));
-
-  int tSize = options->simWidth / 2;
-  for(int i = 0; i < nb; ++i)
+    width(options->simWidth),
+    height(options->simHeight),
+    packedWidth((options->simWidth + 1) / 2),
+    packedHeight((options->simHeight + 1) / 2),
+    maskWidth((options->simWidth + activeCellSize - 1) / activeCellSize),
+    maskHeight((options->simHeight + activeCellSize - 1) / activeCellSize)
+{
+  kernels = {
+    { "copy", &copyProgram },
+    { "clear", &clearProgram },
+    { "maxReduce", &maxReduceProgram },
+    { "addSmokeSpot", &addSmokeSpotProgram },
+    { "mccormack", &maccormackProgram },
+    { "RKAdvect", &RKProgram },
+    { "departure", &departureProgram },
+    { "divCurl", &divCurlProgram },
+    { "divRB", &divRBProgram },
+    { "jacobi", &jacobiProgram },
+    { "jacobiBlack", &jacobiBlackProgram },
+    { "jacobiRed", &jacobiRedProgram },
+    { "jacobiRBTiled", &jacobiRBTiledProgram },
+    { "pressure_projection", &pressureProjectionProgram },
+    { "pressureProjectionRB", &pressureProjectionRBProgram },
+    { "residualRB", &residualRBProgram },
+    { "applyVorticity", &applyVorticityProgram },
+    { "buoyantForce", &applyBuoyantForceProgram },
+    { "bodyForces", &bodyForcesProgram },
+    { "waterContinuity", &waterContinuityProgram },
+    { "activityMask", &activityMaskProgram },
+    { "activeRegion", &activeRegionProgram },
+    { "tileList", &tileListProgram },
+    { "residency", &residencyProgram },
+    { "fillBand", &fillBandProgram },
+    { "applyObstacles", &applyObstaclesProgram }
+  };
+
+  kernelDefines["jacobiRBTiled"] = "#define SWEEPS " + std::to_string(std::max(options->jacobiSweeps, 1u)) + "\n";
+  if(options->interpolation == FAST) kernelDefines["departure"] = "#define FAST_INTERPOLATION\n";
+
+  for(auto& [name, program] : kernels)
   {
-    reduceTextures.emplace_back(createTexture2D(tSize, tSize));
-    tSize /= 2;
+    *program = 0;
+
+    // Kernels with a shared memory tile get smaller work groups when 32x32 does not fit
+    unsigned size = 32;
+    while(size > 1 && !fitsSharedMemory(name, size, size)) size /= 2;
+    setWorkGroupSize(name, size, size);
   }
 
-  emptyTexture = createTexture2D(options->simWidth / 2, options->simHeight / 2);
+  /********** Levels of the reduce **********/
+  unsigned w = width, h = height;
+  do
+  {
+    w = (w + 1) / 2;
+    h = (h + 1) / 2;
+    reduceSizes.emplace_back(w, h);
+  } while(w > 1 || h > 1);
+
+  solver = createPressureSolver(options->pressureSolver, *this, options);
+
+  /********** Sparse fields **********/
+  if(options->sparseTextures && !sparseTexturesSupported())
+  {
+    std::cout << "Sparse textures are not supported, the fields stay dense" << std::endl;
+  }
+  else if(options->sparseTextures)
+  {
+    // A unit is committed in every field at once, whatever the page size of its format
+    unitWidth = unitHeight = activeCellSize;
+    for(GLenum format : { GL_R16F, GL_RG16F, GL_RGBA16F, GL_RG32F })
+    {
+      auto [x, y] = sparsePageSize(format);
+      unitWidth = std::lcm(unitWidth, x);
+      unitHeight = std::lcm(unitHeight, y);
+    }
+
+    if(width % unitWidth != 0 || height % unitHeight != 0)
+    {
+      std::cout << "The grid is not a multiple of the " << unitWidth << "x" << unitHeight
+                << " sparse pages, the fields stay dense" << std::endl;
+    }
+    else
+    {
+      sparse = true;
+      residentUnits = createTexture2D(width / unitWidth, height / unitHeight, GL_R16F, "sparse units");
+      committedUnits.assign((width / unitWidth) * (height / unitHeight), false);
+      unitCommitSteps.assign(committedUnits.size(), 0);
+    }
+  }
+
+  /********** Work group sizes **********/
+  WorkGroupTuner tuner(options->workGroupCache);
+  tuner.apply(*this, width, height, options->autotune);
+
+  // The synthetic velocities of the tuner are gone
+  releaseDepartures();
 }
 
 SimulationFactory::~SimulationFactory()
 {
-  glDeleteTextures(reduceTextures.size(), reduceTextures.data());
-  glDeleteTextures(1, &emptyTexture);
+  if(activeRegion[0] != 0) deleteTextures(2, activeRegion);
+  if(solveRegion != 0) deleteTextures(1, &solveRegion);
+  if(residentUnits != 0) deleteTextures(1, &residentUnits);
+  if(heightProfile != 0) deleteTextures(1, &heightProfile);
+  if(obstacles != 0) deleteTextures(1, &obstacles);
+  if(normBuffer != 0) deleteBuffers(1, &normBuffer);
+  if(normFence) glDeleteSync(normFence);
+
+  for(const ResidencyReadback& readback : residencyReadbacks)
+  {
+    glDeleteSync(readback.fence);
+    residencyBuffers.push_back(readback.buffer);
+  }
+  if(!residencyBuffers.empty()) deleteBuffers(residencyBuffers.size(), residencyBuffers.data());
+
+  for(auto& list : tileLists) deleteBuffers(1, &list.second.buffer);
+  if(splatBuffers[0] != 0) deleteBuffers(2, splatBuffers);
+}
+
+std::vector<std::string> SimulationFactory::kernelNames() const
+{
+  std::vector<std::string> names;
+  for(const auto& kernel : kernels) names.push_back(kernel.first);
+  return names;
+}
+
+void SimulationFactory::setWorkGroupSize(const std::string& kernel, const unsigned x, const unsigned y)
+{
+  GLint *program = kernels.at(kernel);
+  if(*program != 0)
+  {
+    localSizes.erase(*program);
+    glDeleteProgram(*program);
+  }
+
+  std::stringstream defines;
+  defines << "#define LOCAL_SIZE_X " << x << "\n#define LOCAL_SIZE_Y " << y << "\n";
+  if(kernelDefines.count(kernel)) defines << kernelDefines.at(kernel);
+
+  *program = compileAndLinkShader("shaders/simulation/" + kernel + ".comp", GL_COMPUTE_SHADER, defines.str());
+  localSizes[*program] = std::make_tuple(x, y);
+}
+
+std::tuple<unsigned, unsigned> SimulationFactory::workGroupSize(const std::string& kernel) const
+{
+  return localSizes.at(*kernels.at(kernel));
+}
+
+bool SimulationFactory::fitsSharedMemory(const std::string& kernel, const unsigned x, const unsigned y) const
+{
+  std::size_t bytes = 0;
+  if(kernel == "jacobiRBTiled")
+  {
+    // Pressure and divergence tiles of vec4 with a halo of one cell per sweep
+    const std::size_t sweeps = std::max(options->jacobiSweeps, 1u);
+    bytes = 2 * 4 * sizeof(float) * (x + 2 * sweeps) * (y + 2 * sweeps);
+  }
+  else if(kernel == "bodyForces")
+  {
+    // Velocity and curl tiles with a halo of two cells
+    bytes = 3 * sizeof(float) * (x + 4) * (y + 4);
+  }
+  else return true;
+
+  GLint maxBytes;
+  glGetIntegerv(GL_MAX_COMPUTE_SHARED_MEMORY_SIZE, &maxBytes);
+  return bytes <= static_cast<std::size_t>(maxBytes);
+}
+
+void SimulationFactory::useProgram(const GLuint program)
+{
+  // The queued splats land before any other kernel runs
+  if(!splatQueue.empty() && program != static_cast<GLuint>(addSmokeSpotProgram)) flushSplats();
+
+  glUseProgram(program);
+  currentProgram = program;
+}
+
+void SimulationFactory::bindImageTexture(const GLuint binding, const GLuint tex)
+{
+  // The departure points of velocities about to change are stale
+  if(!departures.empty()) releaseDepartures(tex);
+
+  // Images are only written by the kernels, the reads go through the samplers
+  glBindImageTexture(binding, tex, 0, GL_FALSE, 0, GL_WRITE_ONLY, textureFormat(tex));
+  boundBytes += textureBytes(tex);
+
+  // Write after write, or write after a read of an earlier dispatch
+  auto it = unsyncedWrites.find(tex);
+  if(it != unsyncedWrites.end()) requiredBarriers |= it->second & GL_SHADER_IMAGE_ACCESS_BARRIER_BIT;
+  if(unsyncedReads.count(tex)) requiredBarriers |= GL_SHADER_IMAGE_ACCESS_BARRIER_BIT;
+  boundWrites.push_back(tex);
+}
+
+void SimulationFactory::bindTexture(const GLuint binding, const GLuint tex)
+{
+  glActiveTexture(GL_TEXTURE0 + binding);
+  glBindTexture(GL_TEXTURE_2D, tex);
+  boundBytes += textureBytes(tex);
+
+  // Read after write
+  auto it = unsyncedWrites.find(tex);
+  if(it != unsyncedWrites.end()) requiredBarriers |= it->second & GL_TEXTURE_FETCH_BARRIER_BIT;
+  boundReads.push_back(tex);
+}
+
+void SimulationFactory::memoryBarrier(const GLbitfield barriers)
+{
+  if(barriers == 0) return;
+
+  glMemoryBarrier(barriers);
+  ++issuedBarriers;
+
+  for(auto it = unsyncedWrites.begin(); it != unsyncedWrites.end();)
+  {
+    it->second &= ~barriers;
+    if(it->second == 0) it = unsyncedWrites.erase(it);
+    else ++it;
+  }
+  unsyncedReads.clear();
+}
+
+void SimulationFactory::flushBarriers()
+{
+  flushSplats();
+
+  GLbitfield barriers = 0;
+  for(const auto& write : unsyncedWrites) barriers |= write.second;
+  memoryBarrier(barriers);
+}
+
+void SimulationFactory::beginDispatch()
+{
+  // Only the hazards with the previous dispatches get a barrier
+  memoryBarrier(requiredBarriers);
+  requiredBarriers = 0;
+}
+
+void SimulationFactory::endDispatch()
+{
+  for(GLuint tex : boundReads) unsyncedReads.insert(tex);
+  for(GLuint tex : boundWrites)
+    unsyncedWrites[tex] = GL_TEXTURE_FETCH_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT;
+  boundReads.clear();
+  boundWrites.clear();
+
+  // Every resource bound for this dispatch is counted as moved once
+  dispatchedBytes += boundBytes;
+  boundBytes = 0;
+}
+
+void SimulationFactory::dispatch(const unsigned w, const unsigned h)
+{
+  auto [localX, localY] = localSizes[currentProgram];
+
+  beginDispatch();
+
+  // Partial work groups are dispatched entirely, the shaders discard the invocations outside of the grid
+  glDispatchCompute((w + localX - 1) / localX, (h + localY - 1) / localY, 1);
+
+  endDispatch();
 }
 
-void SimulationFactory::dispatch(const unsigned wSize, const unsigned hSize)
+void SimulationFactory::dispatchTiles(const unsigned w, const unsigned h, const GLuint tiles, const unsigned scale, const bool pressure)
 {
-  glDispatchCompute(wSize, hSize, 1);
-  glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+  glUniform1i(glGetUniformLocation(currentProgram, "activeTiles"), tiles != 0);
+  if(tiles == 0)
+  {
+    dispatch(w, h);
+    return;
+  }
+
+  glUniform2i(glGetUniformLocation(currentProgram, "activeCellSize"), regionCellWidth / scale, regionCellHeight / scale);
+  bindTexture(7, pressure ? pressureRegion : region);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, tiles);
+  glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, tiles);
+
+  beginDispatch();
+
+  // The group count is the size of the tile list, written by the compaction on the device
+  glDispatchComputeIndirect(0);
+
+  endDispatch();
 }
 
 void SimulationFactory::copy(const GLuint in, const GLuint out)
 {
-  glUseProgram(copyProgram);
+  auto pass = profiler.scope("copy");
+
+  useProgram(copyProgram);
   bindImageTexture(0, out);
-  bindImageTexture(1, in);
-  dispatch(globalSizeX, globalSizeY);
+  bindTexture(1, in);
+
+  // The program also copies the pressure over the tiles of its solve, so its activeTiles uniform is reset
+  auto [w, h] = textureSize(out);
+  dispatchTiles(w, h, 0, 1);
 }
 
-float SimulationFactory::maxReduce(const GLuint tex)
+void SimulationFactory::clear(const GLuint tex)
 {
-  auto rUtil = [&](const GLuint iTex, const GLuint oTex, const unsigned size)
+  flushSplats();
+  if(!departures.empty()) releaseDepartures(tex);
+
+  // The clear is not a shader access, only the earlier image stores need a barrier
+  auto it = unsyncedWrites.find(tex);
+  if(it != unsyncedWrites.end()) memoryBarrier(it->second & GL_TEXTURE_UPDATE_BARRIER_BIT);
+
+  clearTexture(tex);
+}
+
+void SimulationFactory::clearRB(const GLuint tex)
+{
+  const GLuint tiles = activeTiles(clearProgram, 2, true);
+  if(tiles == 0)
   {
-    glUseProgram(maxReduceProgram);
+    clear(tex);
+    return;
+  }
+
+  auto pass = profiler.scope("clearRB");
+
+  useProgram(clearProgram);
+  bindImageTexture(0, tex);
+  dispatchTiles(packedWidth, packedHeight, tiles, 2, true);
+}
+
+void SimulationFactory::uploadHalf(const GLuint tex, const HalfImage& image)
+{
+  flushSplats();
+  if(!departures.empty()) releaseDepartures(tex);
+
+  // Once the earlier image stores have landed, the upload replaces them for every later access
+  auto it = unsyncedWrites.find(tex);
+  if(it != unsyncedWrites.end())
+  {
+    memoryBarrier(it->second & GL_TEXTURE_UPDATE_BARRIER_BIT);
+    unsyncedWrites.erase(tex);
+  }
+
+  writeTextureHalf(tex, image);
+}
+
+void SimulationFactory::fillBand(const GLuint field, const int bandHeight, const std::tuple<float, float, float, float> value)
+{
+  auto pass = profiler.scope("fillBand");
+
+  useProgram(fillBandProgram);
+  glUniform1i(glGetUniformLocation(fillBandProgram, "bandHeight"), bandHeight);
+  auto [r, g, b, a] = value;
+  glUniform4f(glGetUniformLocation(fillBandProgram, "value"), r, g, b, a);
+  bindImageTexture(0, field);
+
+  auto [w, h] = textureSize(field);
+  dispatch(w, h);
+}
+
+GLuint SimulationFactory::reduce(const GLuint tex)
+{
+  auto pass = profiler.scope("maxReduce");
+
+  // Each level is released as soon as the next one has been reduced from it
+  GLuint iTex = tex;
+  for(unsigned level = 0; level < reduceSizes.size(); ++level)
+  {
+    auto [w, h] = reduceSizes[level];
+    const GLuint oTex = pool.acquire(w, h);
+
+    useProgram(maxReduceProgram);
     bindImageTexture(0, oTex);
     bindTexture(1, iTex);
-    unsigned dSize = std::max(size / 32, 1u);
-    dispatch(dSize, dSize);
-  };
+    dispatch(w, h);
 
-  unsigned tSize = options->simWidth / 2;
-  rUtil(tex, reduceTextures[0], tSize);
-  for(unsigned i = 0; i < reduceTextures.size() - 1; ++i)
-  {
-    tSize /= 2;
-    rUtil(reduceTextures[i], reduceTextures[i + 1], tSize);
+    if(iTex != tex) pool.release(iTex);
+    iTex = oTex;
   }
 
+  auto it = unsyncedWrites.find(iTex);
+  if(it != unsyncedWrites.end()) memoryBarrier(it->second & GL_TEXTURE_UPDATE_BARRIER_BIT);
+
+  return iTex;
+}
+
+float SimulationFactory::maxReduce(const GLuint tex)
+{
+  const GLuint iTex = reduce(tex);
+
   float *data = new float[4];
-  glBindTexture(GL_TEXTURE_2D, reduceTextures[reduceTextures.size() - 1]);
+  glBindTexture(GL_TEXTURE_2D, iTex);
   glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_FLOAT, data);
+  pool.release(iTex);
 
-  using std::max; using std::abs;
-  float m = max(max(max(abs(data[0]), abs(data[1])), abs(data[2])), abs(data[3]));
+  // The channels missing from compact formats read as (0, 0, 1) and are left out
+  float m = 0.0f;
+  for(unsigned c = 0; c < textureChannels(tex); ++c) m = std::max(m, std::abs(data[c]));
 
   delete[] data;
 
   return m;
 }
 
-void SimulationFactory::RKAdvect(const GLuint velocities, const GLuint field_READ, const GLuint field_WRITE, const float dt)
+void SimulationFactory::departure(const GLuint velocities, const GLuint departure_WRITE, const float dt)
 {
-  glUseProgram(RKProgram);
-  GLuint location = glGetUniformLocation(RKProgram, "dt");
+  auto pass = profiler.scope("departure");
+
+  const GLuint tiles = activeTiles(departureProgram, 1);
+
+  useProgram(departureProgram);
+  GLuint location = glGetUniformLocation(departureProgram, "dt");
   glUniform1f(location, dt);
+  bindImageTexture(0, departure_WRITE);
+  bindTexture(1, velocities);
+  dispatchTiles(width, height, tiles, 1);
+}
+
+GLuint SimulationFactory::departurePoints(const GLuint velocities, const float dt)
+{
+  auto key = std::make_tuple(velocities, dt);
+  auto it = departures.find(key);
+  if(it != departures.end()) return it->second;
+
+  const GLuint tex = acquireScratch(GL_RG32F);
+  departure(velocities, tex, dt);
+  departures[key] = tex;
+  return tex;
+}
+
+void SimulationFactory::releaseDepartures(const GLuint velocities)
+{
+  for(auto it = departures.begin(); it != departures.end();)
+  {
+    if(velocities != 0 && std::get<0>(it->first) != velocities)
+    {
+      ++it;
+      continue;
+    }
+
+    pool.release(it->second);
+    it = departures.erase(it);
+  }
+}
+
+void SimulationFactory::RKAdvect(const GLuint velocities, const GLuint field_READ, const GLuint field_WRITE, const float dt)
+{
+  auto pass = profiler.scope("RKAdvect");
+
+  const GLuint departure = departurePoints(velocities, dt);
+  const GLuint tiles = activeTiles(RKProgram, 1);
+
+  useProgram(RKProgram);
   bindImageTexture(0, field_WRITE);
   bindTexture(1, field_READ);
-  bindTexture(2, velocities);
-  dispatch(globalSizeX, globalSizeY);
+  bindTexture(2, departure);
+  dispatchTiles(width, height, tiles, 1);
 }
 
 void SimulationFactory::mcAdvect(const GLuint velocities, const GLuint *fields)
 {
-  RKAdvect(velocities, fields[0], fields[1], options->dt);
-  RKAdvect(velocities, fields[1], fields[2], - options->dt);
-  maccormackStep(fields[3], fields[0], fields[1], fields[2], velocities);
+  const GLenum format = textureFormat(fields[0]);
+  const GLuint scratch[2] = { acquireScratch(format), acquireScratch(format) };
+
+  mcAdvect(velocities, fields, scratch);
+
+  pool.release(scratch[0]);
+  pool.release(scratch[1]);
+}
+
+void SimulationFactory::mcAdvect(const GLuint velocities, const GLuint *fields, const GLuint *scratch)
+{
+  RKAdvect(velocities, fields[0], scratch[0], options->dt);
+  RKAdvect(velocities, scratch[0], scratch[1], - options->dt);
+  maccormackStep(fields[1], fields[0], scratch[0], scratch[1], velocities);
 }
 
 void SimulationFactory::maccormackStep(const GLuint field_WRITE, const GLuint field_n, const GLuint field_n_1, const GLuint field_n_hat, const GLuint velocities)
 {
-  glUseProgram(maccormackProgram);
-  GLuint location = glGetUniformLocation(maccormackProgram, "dt");
-  glUniform1f(location, options->dt);
-  location = glGetUniformLocation(maccormackProgram, "revert");
+  auto pass = profiler.scope("maccormackStep");
+
+  const GLuint departure = departurePoints(velocities, options->dt);
+  const GLuint tiles = activeTiles(maccormackProgram, 1);
+
+  useProgram(maccormackProgram);
+  GLuint location = glGetUniformLocation(maccormackProgram, "revert");
   glUniform1f(location, options->mcRevert);
   bindImageTexture(0, field_WRITE);
   bindTexture(1, field_n);
   bindTexture(2, field_n_hat);
   bindTexture(3, field_n_1);
-  bindTexture(4, velocities);
-  dispatch(globalSizeX, globalSizeY);
+  bindTexture(4, departure);
+  dispatchTiles(width, height, tiles, 1);
 }
 
-void SimulationFactory::RBMethod(const GLuint *velocities, const GLuint divergence, const GLuint pressure)
+void SimulationFactory::project(const GLuint *velocities)
 {
-  glUseProgram(divRBProgram);
-  bindImageTexture(0, divergence);
-  bindTexture(1, velocities[0]);
-  dispatch(globalSizeX / 2, globalSizeY / 2);
+  metrics().pressureIterations.set(options->jacobiIterations);
+  solver->project(velocities);
 
-  copy(emptyTexture, pressure); //TODO
+  if(obstacles != 0) applyObstacles(velocities[1]);
+}
+
+void SimulationFactory::loadObstacles(const MappedField& mask)
+{
+  if(obstacles == 0) obstacles = createTexture2D(width, height, GL_R8, "obstacles");
+  uploadField(mask, obstacles);
+}
+
+void SimulationFactory::applyObstacles(const GLuint velocities)
+{
+  auto pass = profiler.scope("applyObstacles");
+
+  useProgram(applyObstaclesProgram);
+  bindImageTexture(0, velocities);
+  bindTexture(1, velocities);
+  bindTexture(2, obstacles);
+  dispatch(width, height);
+}
+
+void SimulationFactory::requestDivergenceNorm(const GLuint velocities)
+{
+  if(normFence) return;
 
-  for(unsigned i = 0; i < options->jacobiIterations; ++i)
+  const GLuint divergence = pool.acquire(width, height, GL_R32F);
+  divergenceCurl(velocities, divergence);
+  const GLuint texel = reduce(divergence);
+  pool.release(divergence);
+
+  if(normBuffer == 0)
   {
-    glUseProgram(jacobiBlackProgram);
+    glGenBuffers(1, &normBuffer);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, normBuffer);
+    glBufferData(GL_PIXEL_PACK_BUFFER, 4 * sizeof(float), nullptr, GL_STREAM_READ);
+    trackBuffer(normBuffer, 4 * sizeof(float), "metrics");
+  }
+
+  // The copy into the buffer is queued, and the fence tells when it is done
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, normBuffer);
+  glBindTexture(GL_TEXTURE_2D, texel);
+  glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_FLOAT, nullptr);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  pool.release(texel);
+
+  normFence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  glFlush();
+}
+
+bool SimulationFactory::divergenceNorm(float& norm)
+{
+  if(!normFence || glClientWaitSync(normFence, 0, 0) == GL_TIMEOUT_EXPIRED) return false;
+
+  glDeleteSync(normFence);
+  normFence = nullptr;
+
+  float data[4];
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, normBuffer);
+  glGetBufferSubData(GL_PIXEL_PACK_BUFFER, 0, sizeof(data), data);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+  norm = std::abs(data[0]);
+  return true;
+}
+
+void SimulationFactory::divergenceRB(const GLuint velocities, const GLuint divergence_WRITE)
+{
+  auto pass = profiler.scope("divergenceRB");
+
+  const GLuint tiles = activeTiles(divRBProgram, 2, true);
+
+  useProgram(divRBProgram);
+  bindImageTexture(0, divergence_WRITE);
+  bindTexture(1, velocities);
+  dispatchTiles(packedWidth, packedHeight, tiles, 2, true);
+}
+
+void SimulationFactory::jacobiRB(const GLuint divergence, const GLuint pressure, const unsigned iterations)
+{
+  if(options->jacobiSweeps > 1)
+    jacobiRBTiled(divergence, pressure, iterations);
+  else
+    jacobiRBPasses(divergence, pressure, iterations);
+}
+
+void SimulationFactory::jacobiRBPasses(const GLuint divergence, const GLuint pressure, const unsigned iterations)
+{
+  auto pass = profiler.scope("jacobiRB");
+
+  glProgramUniform2i(jacobiBlackProgram, glGetUniformLocation(jacobiBlackProgram, "gridSize"), width, height);
+  glProgramUniform2i(jacobiRedProgram, glGetUniformLocation(jacobiRedProgram, "gridSize"), width, height);
+
+  const GLuint blackTiles = activeTiles(jacobiBlackProgram, 2, true);
+  const GLuint redTiles = activeTiles(jacobiRedProgram, 2, true);
+
+  for(unsigned i = 0; i < iterations; ++i)
+  {
+    useProgram(jacobiBlackProgram);
     bindImageTexture(0, pressure);
     bindTexture(1, pressure);
     bindTexture(2, divergence);
-    dispatch(globalSizeX / 2, globalSizeY / 2);
+    dispatchTiles(packedWidth, packedHeight, blackTiles, 2, true);
 
-    glUseProgram(jacobiRedProgram);
+    useProgram(jacobiRedProgram);
     bindImageTexture(0, pressure);
     bindTexture(1, pressure);
     bindTexture(2, divergence);
-    dispatch(globalSizeX / 2, globalSizeY / 2);
+    dispatchTiles(packedWidth, packedHeight, redTiles, 2, true);
+  }
+}
+
+void SimulationFactory::jacobiRBTiled(const GLuint divergence, const GLuint pressure, const unsigned iterations)
+{
+  auto pass = profiler.scope("jacobiRB");
+
+  const unsigned sweeps = std::max(options->jacobiSweeps, 1u);
+  const GLuint pressureScratch = pool.acquire(packedWidth, packedHeight);
+  const GLuint tiles = activeTiles(jacobiRBTiledProgram, 2, true);
+  const GLuint copyTiles = activeTiles(copyProgram, 2, true);
+
+  useProgram(jacobiRBTiledProgram);
+  glUniform2i(glGetUniformLocation(jacobiRBTiledProgram, "gridSize"), width, height);
+  GLuint location = glGetUniformLocation(jacobiRBTiledProgram, "sweeps");
+
+  // The tiles overlap through their halo, so the dispatches ping-pong with a scratch texture
+  GLuint src = pressure, dst = pressureScratch;
+  for(unsigned done = 0; done < iterations; done += sweeps)
+  {
+    glUniform1i(location, std::min(sweeps, iterations - done));
+    bindImageTexture(0, dst);
+    bindTexture(1, src);
+    bindTexture(2, divergence);
+    dispatchTiles(packedWidth, packedHeight, tiles, 2, true);
+    std::swap(src, dst);
+  }
+
+  if(src != pressure)
+  {
+    useProgram(copyProgram);
+    bindImageTexture(0, pressure);
+    bindTexture(1, src);
+    dispatchTiles(packedWidth, packedHeight, copyTiles, 2, true);
   }
+  pool.release(pressureScratch);
+}
 
-  glUseProgram(pressureProjectionRBProgram);
-  bindImageTexture(0, velocities[1]);
-  bindTexture(1, velocities[0]);
+void SimulationFactory::pressureProjectionRB(const GLuint pressure, const GLuint velocities_READ, const GLuint velocities_WRITE)
+{
+  auto pass = profiler.scope("pressureProjectionRB");
+
+  const GLuint tiles = activeTiles(pressureProjectionRBProgram, 2, true);
+
+  useProgram(pressureProjectionRBProgram);
+  bindImageTexture(0, velocities_WRITE);
+  bindTexture(1, velocities_READ);
   bindTexture(2, pressure);
-  dispatch(globalSizeX / 2, globalSizeY / 2);
+  dispatchTiles(packedWidth, packedHeight, tiles, 2, true);
+}
+
+void SimulationFactory::residualRB(const GLuint pressure_READ, const GLuint correction, const GLuint divergence, const GLuint pressure_WRITE, const GLuint residual_WRITE)
+{
+  auto pass = profiler.scope("residualRB");
+
+  const GLuint tiles = activeTiles(residualRBProgram, 2, true);
+
+  useProgram(residualRBProgram);
+  glUniform2i(glGetUniformLocation(residualRBProgram, "gridSize"), width, height);
+  bindImageTexture(0, pressure_WRITE);
+  bindImageTexture(1, residual_WRITE);
+  bindTexture(2, pressure_READ);
+  bindTexture(3, correction);
+  bindTexture(4, divergence);
+  dispatchTiles(packedWidth, packedHeight, tiles, 2, true);
 }
 
 void SimulationFactory::divergenceCurl(const GLuint velocities, const GLuint divergence_curl_WRITE)
 {
-  glUseProgram(divCurlProgram);
+  auto pass = profiler.scope("divergenceCurl");
+
+  useProgram(divCurlProgram);
   bindImageTexture(0, divergence_curl_WRITE);
   bindTexture(1, velocities);
-  dispatch(globalSizeX, globalSizeY);
+  dispatch(width, height);
 }
 
 void SimulationFactory::solvePressure(const GLuint divergence_READ, const GLuint pressure_READ, const GLuint pressure_WRITE)
 {
-  glUseProgram(jacobiProgram);
+  auto pass = profiler.scope("solvePressure");
+
+  useProgram(jacobiProgram);
   bindImageTexture(0, pressure_WRITE);
   bindTexture(1, pressure_READ);
   bindTexture(2, divergence_READ);
-  dispatch(globalSizeX, globalSizeY);
+  dispatch(width, height);
 }
 
 void SimulationFactory::pressureProjection(const GLuint pressure_READ, const GLuint velocities_READ, const GLuint velocities_WRITE)
 {
-  glUseProgram(pressureProjectionProgram);
+  auto pass = profiler.scope("pressureProjection");
+
+  useProgram(pressureProjectionProgram);
   bindImageTexture(0, velocities_WRITE);
   bindTexture(1, velocities_READ);
   bindTexture(2, pressure_READ);
-  dispatch(globalSizeX, globalSizeY);
+  dispatch(width, height);
 }
 
 void SimulationFactory::applyVorticity(const GLuint velocities_READ_WRITE, const GLuint curl)
 {
-  glUseProgram(applyVorticityProgram);
+  auto pass = profiler.scope("applyVorticity");
+
+  useProgram(applyVorticityProgram);
   GLuint location = glGetUniformLocation(applyVorticityProgram, "dt");
   glUniform1f(location, options->dt);
   bindImageTexture(0, velocities_READ_WRITE);
   bindTexture(1, curl);
-  dispatch(globalSizeX, globalSizeY);
+  bindTexture(2, velocities_READ_WRITE);
+  dispatch(width, height);
 }
 
 void SimulationFactory::applyBuoyantForce(const GLuint velocities_READ_WRITE, const GLuint temperature, const GLuint density, const float kappa, const float sigma, const float t0)
 {
-  glUseProgram(applyBuoyantForceProgram);
+  auto pass = profiler.scope("applyBuoyantForce");
+
+  const GLuint tiles = activeTiles(applyBuoyantForceProgram, 1);
+
+  useProgram(applyBuoyantForceProgram);
   GLuint location = glGetUniformLocation(applyBuoyantForceProgram, "dt");
   glUniform1f(location, options->dt);
   location = glGetUniformLocation(applyBuoyantForceProgram, "kappa");
@@ -243,7 +795,34 @@ void SimulationFactory::applyBuoyantForce(const GLuint velocities_READ_WRITE, co
   bindImageTexture(0, velocities_READ_WRITE);
   bindTexture(1, temperature);
   bindTexture(2, density);
-  dispatch(globalSizeX, globalSizeY);
+  bindTexture(3, velocities_READ_WRITE);
+  dispatchTiles(width, height, tiles, 1);
+}
+
+void SimulationFactory::applyBodyForces(const GLuint velocities_READ, const GLuint velocities_WRITE,
+    const GLuint temperature, const GLuint density, const float kappa, const float sigma, const float t0,
+    const std::tuple<float, float> force)
+{
+  auto pass = profiler.scope("applyBodyForces");
+
+  auto [fx, fy] = force;
+
+  useProgram(bodyForcesProgram);
+  GLuint location = glGetUniformLocation(bodyForcesProgram, "dt");
+  glUniform1f(location, options->dt);
+  location = glGetUniformLocation(bodyForcesProgram, "kappa");
+  glUniform1f(location, kappa);
+  location = glGetUniformLocation(bodyForcesProgram, "sigma");
+  glUniform1f(location, sigma);
+  location = glGetUniformLocation(bodyForcesProgram, "t0");
+  glUniform1f(location, t0);
+  location = glGetUniformLocation(bodyForcesProgram, "externalForce");
+  glUniform2f(location, fx, fy);
+  bindImageTexture(0, velocities_WRITE);
+  bindTexture(1, velocities_READ);
+  bindTexture(2, temperature);
+  bindTexture(3, density);
+  dispatch(width, height);
 }
 
 void SimulationFactory::addSplat(const GLuint field, const std::tuple<int, int> pos, const std::tuple<float, float, float> color, const float intensity)
@@ -251,22 +830,367 @@ void SimulationFactory::addSplat(const GLuint field, const std::tuple<int, int>
   auto [x, y] = pos;
   auto [r, g, b] = color;
 
-  glUseProgram(addSmokeSpotProgram);
-  GLuint location = glGetUniformLocation(addSmokeSpotProgram, "spotPos");
-  glUniform2i(location, x, y);
-  location = glGetUniformLocation(addSmokeSpotProgram, "color");
-  glUniform3f(location, r, g, b);
-  location = glGetUniformLocation(addSmokeSpotProgram, "intensity");
-  glUniform1f(location, intensity);
-  bindImageTexture(0, field);
-  dispatch(globalSizeX, globalSizeY);
+  // The Gaussian is cut where it no longer changes a 16 bits float, which drops the splats too faint to show
+  const float peak = intensity * std::max({ std::abs(r), std::abs(g), std::abs(b) });
+  if(peak <= splatThreshold) return;
+
+  const float radius = std::ceil(std::sqrt(200.0f * std::log(peak / splatThreshold)));
+  splatQueue.push_back({ field, x, y, r, g, b, intensity, radius });
+}
+
+void SimulationFactory::flushSplats()
+{
+  if(splatQueue.empty()) return;
+
+  // Taken out first, the residency changes below flush the barriers
+  std::vector<QueuedSplat> queue;
+  std::swap(queue, splatQueue);
+
+  auto pass = profiler.scope("addSplat");
+
+  auto [localX, localY] = localSizes[addSmokeSpotProgram];
+  const unsigned tilesX = (width + localX - 1) / localX, tilesY = (height + localY - 1) / localY;
+
+  // Each dispatch writes up to four fields, with the tiles covered by the squares of their splats
+  for(std::size_t first = 0; first < queue.size();)
+  {
+    std::vector<GLuint> fields;
+    std::vector<GPUSplat> splats;
+    std::vector<bool> covered(tilesX * tilesY, false);
+
+    std::size_t last = first;
+    for(; last < queue.size(); ++last)
+    {
+      const QueuedSplat& splat = queue[last];
+      auto it = std::find(fields.begin(), fields.end(), splat.field);
+      if(it == fields.end() && fields.size() == 4) break;
+      if(it == fields.end()) it = fields.insert(fields.end(), splat.field);
+
+      const GLint field = static_cast<GLint>(it - fields.begin());
+      splats.push_back({ splat.x, splat.y, field, splat.intensity, splat.r, splat.g, splat.b, splat.radius });
+
+      const int radius = static_cast<int>(splat.radius);
+      const int x0 = std::max(splat.x - radius, 0), x1 = std::min(splat.x + radius, static_cast<int>(width) - 1);
+      const int y0 = std::max(splat.y - radius, 0), y1 = std::min(splat.y + radius, static_cast<int>(height) - 1);
+      for(int ty = y0 / static_cast<int>(localY); y0 <= y1 && ty <= y1 / static_cast<int>(localY); ++ty)
+        for(int tx = x0 / static_cast<int>(localX); x0 <= x1 && tx <= x1 / static_cast<int>(localX); ++tx)
+          covered[ty * tilesX + tx] = true;
+
+      // A splat only lands in committed pages, so the units under its square become resident first
+      if(sparse && x0 <= x1 && y0 <= y1)
+      {
+        for(unsigned uy = y0 / unitHeight; uy <= y1 / unitHeight; ++uy)
+          for(unsigned ux = x0 / unitWidth; ux <= x1 / unitWidth; ++ux)
+            setUnitResidency(ux, uy, true);
+      }
+    }
+
+    std::vector<GLuint> tiles;
+    for(unsigned t = 0; t < covered.size(); ++t)
+      if(covered[t]) tiles.push_back((t % tilesX) | ((t / tilesX) << 16));
+
+    first = last;
+    if(tiles.empty()) continue;
+
+    if(splatBuffers[0] == 0) glGenBuffers(2, splatBuffers);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, splatBuffers[0]);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, splats.size() * sizeof(GPUSplat), splats.data(), GL_STREAM_DRAW);
+    trackBuffer(splatBuffers[0], splats.size() * sizeof(GPUSplat), "splats");
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, splatBuffers[1]);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, tiles.size() * sizeof(GLuint), tiles.data(), GL_STREAM_DRAW);
+    trackBuffer(splatBuffers[1], tiles.size() * sizeof(GLuint), "splats");
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, splatBuffers[0]);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, splatBuffers[1]);
+
+    useProgram(addSmokeSpotProgram);
+    glUniform1i(glGetUniformLocation(addSmokeSpotProgram, "splatCount"), static_cast<GLint>(splats.size()));
+
+    // The samplers of the unused slots get the last field, no splat points to these slots
+    for(unsigned i = 0; i < 4; ++i)
+    {
+      const GLuint field = fields[std::min<std::size_t>(i, fields.size() - 1)];
+      if(i < fields.size()) bindImageTexture(i, field);
+      bindTexture(4 + i, field);
+    }
+
+    beginDispatch();
+    glDispatchCompute(static_cast<GLuint>(tiles.size()), 1, 1);
+    endDispatch();
+  }
 }
 
 void SimulationFactory::updateQAndTheta(const GLuint qTex, const GLuint* thetaTex)
 {
-  glUseProgram(waterContinuityProgram);
+  auto pass = profiler.scope("updateQAndTheta");
+
+  if(heightProfile == 0) setAtmosphere(Atmosphere());
+
+  useProgram(waterContinuityProgram);
   bindImageTexture(0, qTex);
   bindImageTexture(1, thetaTex[2]);
   bindTexture(2, thetaTex[0]);
-  dispatch(globalSizeX, globalSizeY);
+  bindTexture(3, qTex);
+  bindTexture(4, thetaTex[2]);
+  bindTexture(5, heightProfile);
+  dispatch(width, height);
+}
+
+void SimulationFactory::setAtmosphere(const Atmosphere& atmosphere)
+{
+  if(heightProfile == 0) heightProfile = createTexture2D(1, height, GL_RGBA32F, "height profile");
+
+  // Pressure of the row and the factors of the saturation and the latent heat
+  auto profile = [this, atmosphere](unsigned, unsigned y)
+  {
+    const double z = static_cast<double>(y) / height;
+    const double p = atmosphere.p0 * std::pow(1.0 - z * atmosphere.lapseRate / atmosphere.t0, atmosphere.g / (atmosphere.lapseRate / atmosphere.rd));
+    const double exner = std::pow(atmosphere.p0 / p, static_cast<double>(atmosphere.kappa));
+    return std::make_tuple(static_cast<float>(p), static_cast<float>(380.16 / p), static_cast<float>(exner),
+                           static_cast<float>(atmosphere.rd * atmosphere.l / atmosphere.kappa * exner));
+  };
+
+  fillTextureWithFunctor(heightProfile, 1, height, profile);
+}
+
+/********** Active Tiles **********/
+void SimulationFactory::updateActiveTiles(const std::vector<GLuint>& fields)
+{
+  auto pass = profiler.scope("updateActiveTiles");
+
+  if(activeRegion[0] == 0)
+  {
+    activeRegion[0] = createTexture2D(maskWidth, maskHeight, GL_R16F, "active tiles");
+    activeRegion[1] = createTexture2D(maskWidth, maskHeight, GL_R16F, "active tiles");
+  }
+
+  // The alpha channel of the splatted fields is always 1 and is not checked
+  GLint channels[3] = { 0, 0, 0 };
+  for(unsigned i = 0; i < fields.size() && i < 3; ++i) channels[i] = std::min(textureChannels(fields[i]), 3u);
+
+  const GLuint activity = pool.acquire(maskWidth, maskHeight, GL_R16F);
+
+  useProgram(activityMaskProgram);
+  glUniform1i(glGetUniformLocation(activityMaskProgram, "cellSize"), activeCellSize);
+  glUniform3i(glGetUniformLocation(activityMaskProgram, "channels"), channels[0], channels[1], channels[2]);
+  glUniform1f(glGetUniformLocation(activityMaskProgram, "threshold"), activityThreshold);
+  bindImageTexture(0, activity);
+  for(unsigned i = 0; i < 3; ++i) bindTexture(2 + i, fields[std::min<std::size_t>(i, fields.size() - 1)]);
+  dispatch(maskWidth, maskHeight);
+
+  useProgram(activeRegionProgram);
+  glUniform2i(glGetUniformLocation(activeRegionProgram, "margin"), activeMargin, activeMargin);
+  glUniform1i(glGetUniformLocation(activeRegionProgram, "sticky"), !sparse);
+  bindImageTexture(0, activeRegion[1]);
+  bindTexture(1, activeRegion[0]);
+  bindTexture(2, activity);
+  dispatch(maskWidth, maskHeight);
+
+  std::swap(activeRegion[0], activeRegion[1]);
+
+  // From a zero pressure, each Red-Black iteration and each residual pass of the mixed solver
+  // carries the divergence one packed cell further, and the divergence and the projection read
+  // a few cells around. Beyond this reach, the pressure of a solve over the whole grid is zero.
+  const unsigned reach = 2 * (options->jacobiIterations + options->refinementPasses) + activeCellSize;
+  const int solveMargin = (reach + activeCellSize - 1) / activeCellSize;
+
+  if(solveRegion == 0) solveRegion = createTexture2D(maskWidth, maskHeight, GL_R16F, "active tiles");
+
+  // Separable dilation, through the activity texture
+  glUniform1i(glGetUniformLocation(activeRegionProgram, "sticky"), false);
+  glUniform2i(glGetUniformLocation(activeRegionProgram, "margin"), solveMargin, 0);
+  bindImageTexture(0, activity);
+  bindTexture(1, activeRegion[0]);
+  bindTexture(2, activeRegion[0]);
+  dispatch(maskWidth, maskHeight);
+
+  glUniform2i(glGetUniformLocation(activeRegionProgram, "margin"), 0, solveMargin);
+  bindImageTexture(0, solveRegion);
+  bindTexture(1, activity);
+  bindTexture(2, activity);
+  dispatch(maskWidth, maskHeight);
+
+  pool.release(activity);
+
+  if(sparse)
+  {
+    updateResidency();
+  }
+  else
+  {
+    region = activeRegion[0];
+    pressureRegion = solveRegion;
+    regionCellWidth = regionCellHeight = activeCellSize;
+  }
+
+  // The backtraces only cover the previous region
+  releaseDepartures();
+  for(auto& list : tileLists) list.second.valid = false;
+}
+
+GLuint SimulationFactory::activeTiles(const GLuint program, const unsigned scale, const bool pressure)
+{
+  const GLuint tilesRegion = pressure ? pressureRegion : region;
+  if(tilesRegion == 0) return 0;
+
+  auto [localX, localY] = localSizes[program];
+  const unsigned countX = ((width + scale - 1) / scale + localX - 1) / localX;
+  const unsigned countY = ((height + scale - 1) / scale + localY - 1) / localY;
+
+  TileList& list = tileLists[std::make_tuple(localX, localY, scale, pressure)];
+  if(list.valid) return list.buffer;
+
+  // Header with the indirect dispatch arguments, followed by room for every tile
+  const GLuint header[3] = { 0, 1, 1 };
+  if(list.buffer == 0)
+  {
+    glGenBuffers(1, &list.buffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, list.buffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(header) + sizeof(GLuint) * countX * countY, nullptr, GL_DYNAMIC_COPY);
+    trackBuffer(list.buffer, sizeof(header) + sizeof(GLuint) * countX * countY, "active tiles");
+  }
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, list.buffer);
+  glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(header), header);
+
+  useProgram(tileListProgram);
+  glUniform2i(glGetUniformLocation(tileListProgram, "tileSize"), localX, localY);
+  glUniform2i(glGetUniformLocation(tileListProgram, "tileCount"), countX, countY);
+  glUniform1i(glGetUniformLocation(tileListProgram, "scale"), scale);
+  glUniform2i(glGetUniformLocation(tileListProgram, "cellSize"), regionCellWidth, regionCellHeight);
+  bindTexture(1, tilesRegion);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, list.buffer);
+  dispatch(countX, countY);
+
+  // The list is read as dispatch arguments and storage, and reset by the next update
+  memoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+
+  list.valid = true;
+  return list.buffer;
+}
+
+/********** Sparse Fields **********/
+GLuint SimulationFactory::createField(const GLenum format, const char *tag)
+{
+  if(!sparse) return createTexture2D(width, height, format, tag);
+
+  const GLuint tex = createSparseTexture2D(width, height, format, tag);
+  makeResident(tex);
+  return tex;
+}
+
+GLuint SimulationFactory::acquireScratch(const GLenum format)
+{
+  const GLuint tex = pool.acquire(width, height, format, sparse);
+  if(sparse) makeResident(tex);
+  return tex;
+}
+
+void SimulationFactory::makeResident(const GLuint tex)
+{
+  if(std::find(residentTextures.begin(), residentTextures.end(), tex) != residentTextures.end()) return;
+
+  residentTextures.push_back(tex);
+
+  const unsigned unitsX = width / unitWidth;
+  for(std::size_t i = 0; i < committedUnits.size(); ++i)
+  {
+    if(!committedUnits[i]) continue;
+    commitTexturePages(tex, (i % unitsX) * unitWidth, (i / unitsX) * unitHeight, unitWidth, unitHeight, true);
+  }
+}
+
+void SimulationFactory::setUnitResidency(const unsigned x, const unsigned y, const bool resident)
+{
+  const std::size_t i = y * (width / unitWidth) + x;
+  if(committedUnits[i] == resident) return;
+
+  // The cleared pages are written by the API, after the pending dispatches
+  flushBarriers();
+
+  for(GLuint tex : residentTextures) commitTexturePages(tex, x * unitWidth, y * unitHeight, unitWidth, unitHeight, resident);
+  committedUnits[i] = resident;
+  if(resident) unitCommitSteps[i] = residencyStep;
+  unitsChanged = true;
+}
+
+void SimulationFactory::updateResidency()
+{
+  const unsigned unitsX = width / unitWidth, unitsY = height / unitHeight;
+
+  /********** Units wanted by the region, read back without waiting **********/
+  const GLuint wanted = pool.acquire(unitsX, unitsY, GL_R16F);
+
+  useProgram(residencyProgram);
+  glUniform2i(glGetUniformLocation(residencyProgram, "unitSize"), unitWidth / activeCellSize, unitHeight / activeCellSize);
+  glUniform1i(glGetUniformLocation(residencyProgram, "margin"), residencyLatency * activeMargin);
+  bindImageTexture(0, wanted);
+  bindTexture(1, solveRegion);
+  dispatch(unitsX, unitsY);
+  flushBarriers();
+
+  ResidencyReadback request = { 0, nullptr, residencyStep };
+  if(residencyBuffers.empty())
+  {
+    glGenBuffers(1, &request.buffer);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, request.buffer);
+    glBufferData(GL_PIXEL_PACK_BUFFER, unitsX * unitsY * sizeof(float), nullptr, GL_STREAM_READ);
+    trackBuffer(request.buffer, unitsX * unitsY * sizeof(float), "sparse units");
+  }
+  else
+  {
+    request.buffer = residencyBuffers.back();
+    residencyBuffers.pop_back();
+  }
+
+  // The copy into the buffer is queued, and the fence tells when it is done
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, request.buffer);
+  glBindTexture(GL_TEXTURE_2D, wanted);
+  glGetTexImage(GL_TEXTURE_2D, 0, GL_RED, GL_FLOAT, nullptr);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  pool.release(wanted);
+
+  request.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  glFlush();
+  residencyReadbacks.push_back(request);
+
+  /********** Commits of the completed readbacks **********/
+  // In request order. A readback is only waited for once it is residencyLatency steps old, past
+  // the guard band of its units, or on the first step, when no unit surrounds the region yet.
+  std::vector<float> units(unitsX * unitsY);
+  while(!residencyReadbacks.empty())
+  {
+    const ResidencyReadback readback = residencyReadbacks.front();
+    const bool late = residencyStep == 0 || residencyStep - readback.step >= residencyLatency;
+    const GLenum status = late ? glClientWaitSync(readback.fence, GL_SYNC_FLUSH_COMMANDS_BIT, std::numeric_limits<GLuint64>::max())
+                               : glClientWaitSync(readback.fence, 0, 0);
+    if(status == GL_TIMEOUT_EXPIRED) break;
+
+    glDeleteSync(readback.fence);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+    glGetBufferSubData(GL_PIXEL_PACK_BUFFER, 0, units.size() * sizeof(float), units.data());
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    residencyBuffers.push_back(readback.buffer);
+    residencyReadbacks.pop_front();
+
+    // The units committed after the request, like those of a later splat, may hold smoke the readback does not see
+    for(std::size_t i = 0; i < units.size(); ++i)
+    {
+      if(units[i] > 0.0f || unitCommitSteps[i] <= readback.step)
+        setUnitResidency(i % unitsX, i / unitsX, units[i] > 0.0f);
+    }
+  }
+
+  // The tiled kernels cover the committed units entirely, so no cell of a page keeps a stale value
+  if(unitsChanged)
+  {
+    fillTextureWithFunctor(residentUnits, unitsX, unitsY, [this, unitsX](unsigned x, unsigned y)
+    {
+      return std::make_tuple(committedUnits[y * unitsX + x] ? 1.0f : 0.0f, 0.0f, 0.0f, 0.0f);
+    });
+    unitsChanged = false;
+  }
+
+  region = pressureRegion = residentUnits;
+  regionCellWidth = unitWidth;
+  regionCellHeight = unitHeight;
+  ++residencyStep;
 }
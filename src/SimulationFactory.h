@@ -2,10 +2,21 @@
 #define SIMULATIONFACTORY_H
 
 #include "GLUtils.h"
+#include "FieldFile.h"
 #include "ProgramOptions.h"
+#include "GPUProfiler.h"
+#include "PressureSolver.h"
+#include "TexturePool.h"
 
+#include <deque>
 #include <functional>
+#include <map>
+#include <memory>
+#include <string>
 #include <tuple>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 void fillTextureWithFunctor(GLuint tex, const unsigned width, const unsigned height,
   std::function<std::tuple<float, float, float, float>(unsigned, unsigned)> f);
@@ -13,49 +24,344 @@ void fillTextureWithFunctor(GLuint tex, const unsigned width, const unsigned hei
 class SimulationFactory
 {
   public:
+    /**
+     * Constants of the atmosphere of the clouds thermodynamics
+     */
+    struct Atmosphere
+    {
+      float g = 9.80665f;
+      float p0 = 101325.0f;
+      float t0 = 290.0f;
+      float lapseRate = 10.0f;
+      float rd = 287.0f;
+      float kappa = 0.286f;
+      float l = 2.501f;
+    };
+
     SimulationFactory(ProgramOptions *options);
 
     ~SimulationFactory();
 
     void copy(const GLuint in, const GLuint out);
+
+    /**
+     * Zeroes a texture with clearTexture(), after the kernels writing it
+     */
+    void clear(const GLuint tex);
+
+    /**
+     * Zeroes a packed texture of the pressure solve over the tiles of its region, or
+     * entirely with clear() when no region exists yet
+     */
+    void clearRB(const GLuint tex);
+
+    /**
+     * Replaces the texels of a 2 or 4 channels texture with an image computed on the
+     * host, after the kernels writing it. The departure points of the texture are dropped.
+     */
+    void uploadHalf(const GLuint tex, const HalfImage& image);
+
+    /**
+     * Fills a field with the value on the rows up to bandHeight and zero above
+     */
+    void fillBand(const GLuint field, const int bandHeight, const std::tuple<float, float, float, float> value);
+
+    /**
+     * Largest absolute value of the channels of a texture, read back from the GPU
+     */
     float maxReduce(const GLuint tex);
+
+    /**
+     * Starts reducing the largest absolute divergence of the velocities, read back through
+     * a pixel buffer. Nothing is started while the previous request is pending.
+     */
+    void requestDivergenceNorm(const GLuint velocities);
+
+    /**
+     * Result of the last requestDivergenceNorm(), without waiting for the GPU
+     * @return false while the reduction is pending or when nothing was requested
+     */
+    bool divergenceNorm(float& norm);
+    /**
+     * Queues a Gaussian splat, added to the field by the next flushSplats(). Any other
+     * kernel and flushBarriers() flush the queue first.
+     */
     void addSplat(const GLuint field, const std::tuple<int, int> pos, const std::tuple<float, float, float> color, const float intensity);
+
+    /**
+     * Adds the queued splats within the tiles covered by their squares, with one
+     * dispatch per group of four target fields
+     */
+    void flushSplats();
     void simpleAdvect(const GLuint velocities, const GLuint field_READ, const GLuint field_WRITE);
     void RKAdvect(const GLuint velocities, const GLuint field_READ, const GLuint field_WRITE, const float dt);
-    void mcAdvect(const GLuint velocities, const GLuint *fieldst);
+
+    /**
+     * Departure points of the RK4 backtrace of every cell over dt, in cells
+     */
+    void departure(const GLuint velocities, const GLuint departure_WRITE, const float dt);
+
+    /**
+     * MacCormack advection from fields[0] (READ) into fields[1] (WRITE), with
+     * the forward and backward advected fields in transient textures
+     */
+    void mcAdvect(const GLuint velocities, const GLuint *fields);
+
+    /**
+     * Same, keeping the forward and backward advected fields in scratch[0] and scratch[1]
+     */
+    void mcAdvect(const GLuint velocities, const GLuint *fields, const GLuint *scratch);
+
     void maccormackStep(const GLuint field_WRITE, const GLuint field_n, const GLuint field_n_1, const GLuint field_n_hat, const GLuint velocities);
     void divergenceCurl(const GLuint velocities, const GLuint divergence_curl_WRITE);
     void solvePressure(const GLuint divergence_READ, const GLuint pressure_READ, const GLuint pressure_WRITE);
     void pressureProjection(const GLuint pressure_READ, const GLuint velocities_READ, const GLuint velocities_WRITE);
-    void RBMethod(const GLuint *velocities, const GLuint divergence, const GLuint pressure);
+
+    /**
+     * Pressure projection of velocities[0] into velocities[1] with the solver of --pressure-solver
+     */
+    void project(const GLuint *velocities);
+
+    /**
+     * Sets the obstacle mask, a GL_R8 texture of the grid whose cells over one half are
+     * solid. The velocities are zeroed in the solid cells after every projection.
+     */
+    void loadObstacles(const MappedField& mask);
+
+    /**
+     * Zeroes the velocities inside the obstacles, in place
+     */
+    void applyObstacles(const GLuint velocities);
+
+    void divergenceRB(const GLuint velocities, const GLuint divergence_WRITE);
+    void jacobiRB(const GLuint divergence, const GLuint pressure, const unsigned iterations);
+    void jacobiRBPasses(const GLuint divergence, const GLuint pressure, const unsigned iterations);
+    void jacobiRBTiled(const GLuint divergence, const GLuint pressure, const unsigned iterations);
+    void pressureProjectionRB(const GLuint pressure, const GLuint velocities_READ, const GLuint velocities_WRITE);
+
+    /**
+     * Adds the correction to the packed pressure and computes the residual of the new
+     * pressure, both in the format of the given textures
+     */
+    void residualRB(const GLuint pressure_READ, const GLuint correction, const GLuint divergence, const GLuint pressure_WRITE, const GLuint residual_WRITE);
     void applyVorticity(const GLuint velocities_READ_WRITE, const GLuint curl);
     void applyBuoyantForce(const GLuint velocities_READ_WRITE, const GLuint temperature, const GLuint density, const float kappa, const float sigma, const float t0);
+
+    /**
+     * applyBuoyantForce(), divergenceCurl() and applyVorticity() in a single pass, with an
+     * additional constant force
+     */
+    void applyBodyForces(const GLuint velocities_READ, const GLuint velocities_WRITE,
+        const GLuint temperature, const GLuint density, const float kappa, const float sigma, const float t0,
+        const std::tuple<float, float> force = std::make_tuple(0.0f, 0.0f));
     void updateQAndTheta(const GLuint qTex, const GLuint* thetaTex);
+
+    /**
+     * Rebuilds the height profile of the pressure and Exner terms read by updateQAndTheta(),
+     * which otherwise uses the default atmosphere
+     */
+    void setAtmosphere(const Atmosphere& atmosphere);
+
+    /**
+     * Grows the active region with the blocks where one of the fields is not
+     * negligible. Once a region exists, the advection and buoyancy kernels only run
+     * on the tiles covering it through indirect dispatches. The kernels of the Red-Black
+     * solve run on the region dilated by the reach of the Jacobi iterations, outside of
+     * which the pressure is zero.
+     * @param fields the state fields whose blocks are checked
+     */
+    void updateActiveTiles(const std::vector<GLuint>& fields);
+
+    /**
+     * Allocates a field of the grid. With --sparse-textures, the field is a sparse
+     * texture whose pages are committed by updateActiveTiles() around the active region,
+     * and decommitted once the region leaves them.
+     * @param format the sized internal format
+     * @param tag the memory report entry of the field
+     */
+    GLuint createField(const GLenum format, const char *tag);
+
+    /**
+     * Whether the fields are sparse textures
+     */
+    bool sparseFields() const { return sparse; }
+
+    /**
+     * Names of the compute kernels, which are also the names of their shader files
+     */
+    std::vector<std::string> kernelNames() const;
+
+    /**
+     * Recompiles a kernel with another work group shape
+     * @param kernel name of the kernel
+     * @param x the local size along x
+     * @param y the local size along y
+     */
+    void setWorkGroupSize(const std::string& kernel, const unsigned x, const unsigned y);
+    std::tuple<unsigned, unsigned> workGroupSize(const std::string& kernel) const;
+
+    /**
+     * Whether the shared memory of a kernel fits the device for a work group shape
+     */
+    bool fitsSharedMemory(const std::string& kernel, const unsigned x, const unsigned y) const;
+
+    /**
+     * Issues the barriers still needed for the results of the dispatches to be
+     * visible to texture fetches, image accesses and texture downloads, which
+     * lets the renderer and the readbacks use any field. The queued splats land first.
+     */
+    void flushBarriers();
+
+    std::size_t trafficBytes() const { return dispatchedBytes; }
+    std::size_t barrierCount() const { return issuedBarriers; }
+    void resetTraffic() { dispatchedBytes = 0; issuedBarriers = 0; }
+
+    GPUProfiler profiler;
+
+    /**
+     * Transient textures of the passes, also available to the simulations
+     */
+    TexturePool pool;
   private:
-    void dispatch(const unsigned wSize, const unsigned hSize);
+    void bindImageTexture(const GLuint binding, const GLuint tex);
+    void bindTexture(const GLuint binding, const GLuint tex);
+    void useProgram(const GLuint program);
+    void dispatch(const unsigned w, const unsigned h);
+    void dispatchTiles(const unsigned w, const unsigned h, const GLuint tiles, const unsigned scale, const bool pressure = false);
+    void beginDispatch();
+    void endDispatch();
+    GLuint activeTiles(const GLuint program, const unsigned scale, const bool pressure = false);
+    GLuint acquireScratch(const GLenum format);
+    void makeResident(const GLuint tex);
+    void updateResidency();
+    void setUnitResidency(const unsigned x, const unsigned y, const bool resident);
+    GLuint reduce(const GLuint tex);
+    GLuint departurePoints(const GLuint velocities, const float dt);
+    void releaseDepartures(const GLuint velocities = 0);
+    void memoryBarrier(const GLbitfield barriers);
 
     ProgramOptions *options;
 
-    unsigned globalSizeX, globalSizeY;
+    // Size of the grid and of the Red-Black packed textures, which get an extra
+    // padding row/column when a dimension is odd
+    unsigned width, height;
+    unsigned packedWidth, packedHeight;
 
     GLint copyProgram;
+    GLint clearProgram;
     GLint maxReduceProgram;
     GLint addSmokeSpotProgram;
     GLint maccormackProgram;
     GLint RKProgram;
+    GLint departureProgram;
     GLint divCurlProgram;
     GLint divRBProgram;
     GLint jacobiProgram;
     GLint jacobiBlackProgram;
     GLint jacobiRedProgram;
+    GLint jacobiRBTiledProgram;
     GLint pressureProjectionProgram;
     GLint pressureProjectionRBProgram;
+    GLint residualRBProgram;
     GLint applyVorticityProgram;
     GLint applyBuoyantForceProgram;
+    GLint bodyForcesProgram;
     GLint waterContinuityProgram;
+    GLint activityMaskProgram;
+    GLint activeRegionProgram;
+    GLint tileListProgram;
+    GLint residencyProgram;
+    GLint fillBandProgram;
+    GLint applyObstaclesProgram;
+
+    // Program of each kernel, and work group shape of each program
+    std::map<std::string, GLint*> kernels;
+    std::map<std::string, std::string> kernelDefines;
+    std::unordered_map<GLuint, std::tuple<unsigned, unsigned>> localSizes;
+    GLuint currentProgram = 0;
+
+    std::vector<std::tuple<unsigned, unsigned>> reduceSizes;
+
+    struct QueuedSplat
+    {
+      GLuint field;
+      int x, y;
+      float r, g, b, intensity, radius;
+    };
+
+    std::vector<QueuedSplat> splatQueue;
+    GLuint splatBuffers[2] = { 0, 0 };
+
+    // Departure points shared by the advections with the same velocities and time step,
+    // until a dispatch writes the velocities
+    std::map<std::tuple<GLuint, float>, GLuint> departures;
+
+    // Active region with one texel per block of cells, and the tiles covering it for
+    // each work group shape, grid scale and region, rebuilt on their first use after an update
+    struct TileList
+    {
+      GLuint buffer = 0;
+      bool valid = false;
+    };
+
+    unsigned maskWidth, maskHeight;
+    GLuint activeRegion[2] = { 0, 0 };
+    std::map<std::tuple<unsigned, unsigned, unsigned, bool>, TileList> tileLists;
+
+    // Active region dilated by the reach of the Jacobi iterations
+    GLuint solveRegion = 0;
+
+    // Regions given to the tiled kernels and to those of the pressure solve, with the
+    // cells covered by each of their texels
+    GLuint region = 0;
+    GLuint pressureRegion = 0;
+    unsigned regionCellWidth, regionCellHeight;
+
+    // With sparse fields, the region is made of the committed residency units, which are the
+    // largest page of the field formats. Every sparse texture has the pages of the committed
+    // units, and the step of its last commit keeps a unit from older readbacks.
+    bool sparse = false;
+    unsigned unitWidth = 0, unitHeight = 0;
+    GLuint residentUnits = 0;
+    std::vector<bool> committedUnits;
+    std::vector<unsigned> unitCommitSteps;
+    bool unitsChanged = false;
+    std::vector<GLuint> residentTextures;
+
+    // Readbacks of the units wanted by the region of a step, applied once their fence is
+    // signaled, and the buffers of the applied ones
+    struct ResidencyReadback
+    {
+      GLuint buffer;
+      GLsync fence;
+      unsigned step;
+    };
+
+    std::deque<ResidencyReadback> residencyReadbacks;
+    std::vector<GLuint> residencyBuffers;
+    unsigned residencyStep = 0;
+    std::unique_ptr<PressureSolver> solver;
+
+    // Per row terms of the thermodynamics, one texel of the column per grid row
+    GLuint heightProfile = 0;
+
+    // Obstacle mask of --obstacles
+    GLuint obstacles = 0;
+
+    // Readback of the divergence norm, and the fence of its pending request
+    GLuint normBuffer = 0;
+    GLsync normFence = nullptr;
+
+    std::size_t boundBytes = 0;
+    std::size_t dispatchedBytes = 0;
 
-    std::vector<GLuint> reduceTextures;
-    GLuint emptyTexture;
+    // Hazards between dispatches: the textures written since their last barrier with the
+    // barrier bits they still need, and the textures read since the last barrier
+    std::unordered_map<GLuint, GLbitfield> unsyncedWrites;
+    std::unordered_set<GLuint> unsyncedReads;
+    std::vector<GLuint> boundReads, boundWrites;
+    GLbitfield requiredBarriers = 0;
+    std::size_t issuedBarriers = 0;
 };
 
 #endif //SIMULATIONFACTORY_H
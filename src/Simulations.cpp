@@ -0,0 +1,167 @@
+#include "Simulations.h"
+#include "SimpleFluid.h"
+#include "Smoke.h"
+#include "Clouds.h"
+#include "FieldFile.h"
+#include "Metrics.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <map>
+
+SimulationBase* createSimulation(ProgramOptions *options, GLFWHandler *handler)
+{
+  switch(options->simType)
+  {
+    case SPLATS:
+      return new SimpleFluid(options, handler);
+    case SMOKE:
+      return new Smoke(options, handler);
+    case CLOUDS:
+      return new Clouds(options, handler);
+  }
+
+  return nullptr;
+}
+
+float advanceSimulation(SimulationBase *sim)
+{
+  ProgramOptions *options = sim->options;
+  if(options->fixedDt <= 0.0f)
+  {
+    sim->Update();
+    return options->dt;
+  }
+
+  // Bounds the cost of a step when the velocities blow up
+  const unsigned maxSubsteps = 256;
+
+  float remaining = options->fixedDt;
+  for(unsigned done = 0;; ++done)
+  {
+    // The simulations swap their READ and WRITE textures, the current velocities change every sub-step
+    const auto fields = sim->Fields();
+    const auto velocities = fields.find("velocities");
+    const float vMax = velocities != fields.end() ? sim->sFact.maxReduce(velocities->second) : 0.0f;
+    metrics().vMax.set(vMax);
+
+    // Sub-steps left for the remaining time, the last one taking all of it
+    const float left = static_cast<float>(maxSubsteps - done);
+    const float substeps = std::ceil(remaining * vMax / options->cfl);
+    const unsigned n = static_cast<unsigned>(std::isfinite(substeps) ? std::clamp(substeps, 1.0f, left) : left);
+
+    options->dt = remaining / n;
+    sim->Update();
+
+    if(n == 1) break;
+    remaining -= options->dt;
+  }
+
+  return options->fixedDt;
+}
+
+void loadInitialConditions(SimulationBase *sim)
+{
+  const ProgramOptions *options = sim->options;
+  const std::map<std::string, std::string> paths = { { "velocities", options->initVelocities },
+                                                     { "density", options->initDensity },
+                                                     { "temperature", options->initTemperature } };
+  const auto fields = sim->Fields();
+
+  // The uploads are not shader accesses, the stores of Init() need to land first
+  sim->sFact.flushBarriers();
+
+  for(const auto& [name, path] : paths)
+  {
+    if(path.empty()) continue;
+
+    auto field = fields.find(name);
+    if(field == fields.end())
+    {
+      std::cout << "The " << options->simType << " simulation has no " << name << " field" << std::endl;
+      exit(1);
+    }
+
+    std::cout << "Loading the initial " << name << " from " << path << std::endl;
+    uploadField(MappedField(path), field->second);
+  }
+
+  if(!options->obstacles.empty())
+  {
+    std::cout << "Loading the obstacles from " << options->obstacles << std::endl;
+    sim->sFact.loadObstacles(MappedField(options->obstacles));
+  }
+}
+
+/********** Memory Budget **********/
+// Runs the first step of the simulation on a grid four times smaller in each direction,
+// and scales its peak memory to the full grid. The memory is dominated by the textures
+// of the grid, so it grows with the number of cells.
+static double estimateBytesPerCell(const ProgramOptions& options, GLFWHandler *handler)
+{
+  ProgramOptions probe = options;
+  probe.simWidth = std::max(options.simWidth / 4, 64u);
+  probe.simHeight = std::max(options.simHeight / 4, 64u);
+  probe.autotune = false;
+  probe.sparseTextures = false;
+
+  std::cout << "Estimating the memory on a " << probe.simWidth << "x" << probe.simHeight << " grid" << std::endl;
+
+  resetPeakTextureBytes();
+  const std::size_t before = allocatedTextureBytes();
+
+  SimulationBase *sim = createSimulation(&probe, handler);
+  sim->Init();
+  sim->Update();
+  sim->sFact.flushBarriers();
+  const std::size_t peak = peakTextureBytes() - before;
+  delete sim;
+
+  resetPeakTextureBytes();
+  return static_cast<double>(peak) / (static_cast<double>(probe.simWidth) * probe.simHeight);
+}
+
+void applyMemoryBudget(ProgramOptions *options, GLFWHandler *handler)
+{
+  if(options->memoryBudget == 0) return;
+
+  const double budget = options->memoryBudget * 1024.0 * 1024.0;
+  auto estimate = [options](const double bytesPerCell)
+  {
+    return bytesPerCell * options->simWidth * options->simHeight;
+  };
+
+  double bytesPerCell = estimateBytesPerCell(*options, handler);
+  std::cout << "Estimated peak GPU memory: " << estimate(bytesPerCell) / (1024.0 * 1024.0) << " MB, budget: "
+            << options->memoryBudget << " MB" << std::endl;
+
+  if(estimate(bytesPerCell) > budget)
+  {
+    if(options->memoryPolicy == FAIL)
+    {
+      std::cerr << "The simulation does not fit in --memory-budget, see --memory-policy downgrade" << std::endl;
+      exit(1);
+    }
+
+    // The fp32 pressures are the only fields that are not 16 bits already
+    if(options->pressureSolver == JACOBI || options->pressureSolver == MIXED)
+    {
+      options->pressureSolver = RED_BLACK;
+      bytesPerCell = estimateBytesPerCell(*options, handler);
+      std::cout << "Downgraded the pressure solver to red-black: " << estimate(bytesPerCell) / (1024.0 * 1024.0) << " MB" << std::endl;
+    }
+
+    if(estimate(bytesPerCell) > budget)
+    {
+      const double scale = std::sqrt(budget / estimate(bytesPerCell));
+      options->simWidth = std::max(static_cast<unsigned>(options->simWidth * scale) & ~1u, 2u);
+      options->simHeight = std::max(static_cast<unsigned>(options->simHeight * scale) & ~1u, 2u);
+      std::cout << "Downgraded the grid to " << options->simWidth << "x" << options->simHeight << ": "
+                << estimate(bytesPerCell) / (1024.0 * 1024.0) << " MB" << std::endl;
+    }
+  }
+
+  // The estimate is checked again by every allocation
+  setMemoryBudget(options->memoryBudget * 1024ull * 1024ull);
+}
@@ -0,0 +1,39 @@
+#ifndef SIMULATIONS_H
+#define SIMULATIONS_H
+
+#include "SimulationBase.h"
+
+/**
+ * Allocates the simulation matching options->simType
+ * @param options the program options
+ * @param handler the OpenGL handler
+ */
+SimulationBase* createSimulation(ProgramOptions *options, GLFWHandler *handler);
+
+/**
+ * Advances the simulation by one step. With --fixed-dt, the step is split into the
+ * fewest sub-steps moving the fluid by at most --cfl cells, with the velocities
+ * measured before each of them, and the last one ends exactly on the step time.
+ * @param sim the simulation
+ * @return the simulated time of the step
+ */
+float advanceSimulation(SimulationBase *sim);
+
+/**
+ * Loads the field files of --init-velocities, --init-density and --init-temperature
+ * into the state of an initialized simulation, and the mask of --obstacles
+ * @param sim the simulation, after its Init()
+ */
+void loadInitialConditions(SimulationBase *sim);
+
+/**
+ * Estimates the peak GPU memory of the simulation and enforces --memory-budget.
+ * Over the budget, the run either stops (--memory-policy fail), or the options fall
+ * back to the 16 bits Red-Black solver and then to the largest grid that fits
+ * (--memory-policy downgrade). The allocations stay checked against the budget.
+ * @param options the program options, possibly downgraded
+ * @param handler the OpenGL handler
+ */
+void applyMemoryBudget(ProgramOptions *options, GLFWHandler *handler);
+
+#endif //SIMULATIONS_H
@@ -1,5 +1,7 @@
 #include "Smoke.h"
 #include "GLUtils.h"
+#include "Metrics.h"
+#include "PassGraph.h"
 
 #include <string>
 #include <sstream>
@@ -8,36 +10,22 @@
 
 Smoke::~Smoke()
 {
-  glDeleteTextures(4, velocitiesTexture);
-  glDeleteTextures(4, density);
-  glDeleteTextures(4, temperature);
-  glDeleteTextures(1, &pressureRBTexture);
-  glDeleteTextures(1, &divRBTexture);
-  glDeleteTextures(1, &divergenceCurlTexture);
+  deleteTextures(2, velocitiesTexture);
+  deleteTextures(2, density);
+  deleteTextures(2, temperature);
 }
 
 void Smoke::Init()
 {
-  density[0] = createTexture2D(options->simWidth, options->simHeight);
-  density[1] = createTexture2D(options->simWidth, options->simHeight);
-  density[2] = createTexture2D(options->simWidth, options->simHeight);
-  density[3] = createTexture2D(options->simWidth, options->simHeight);
+  // Sparse with --sparse-textures, in which case the factory commits their pages
+  density[0] = sFact.createField(GL_RGBA16F, "density");
+  density[1] = sFact.createField(GL_RGBA16F, "density");
 
-  temperature[0] = createTexture2D(options->simWidth, options->simHeight);
-  temperature[1] = createTexture2D(options->simWidth, options->simHeight);
-  temperature[2] = createTexture2D(options->simWidth, options->simHeight);
-  temperature[3] = createTexture2D(options->simWidth, options->simHeight);
+  temperature[0] = sFact.createField(GL_R16F, "temperature");
+  temperature[1] = sFact.createField(GL_R16F, "temperature");
 
-  velocitiesTexture[0] = createTexture2D(options->simWidth, options->simHeight);
-  velocitiesTexture[1] = createTexture2D(options->simWidth, options->simHeight);
-  velocitiesTexture[2] = createTexture2D(options->simWidth, options->simHeight);
-  velocitiesTexture[3] = createTexture2D(options->simWidth, options->simHeight);
-
-  divergenceCurlTexture = createTexture2D(options->simWidth, options->simHeight);
-
-  divRBTexture = createTexture2D(options->simWidth / 2, options->simHeight / 2);
-
-  pressureRBTexture = createTexture2D(options->simWidth / 2, options->simHeight / 2);
+  velocitiesTexture[0] = sFact.createField(GL_RG16F, "velocities");
+  velocitiesTexture[1] = sFact.createField(GL_RG16F, "velocities");
 }
 
 void Smoke::AddSplat()
@@ -52,6 +40,13 @@ void Smoke::RemoveSplat()
 {
 }
 
+std::map<std::string, GLuint> Smoke::Fields() const
+{
+  return { { "velocities", velocitiesTexture[READ] },
+           { "density", density[READ] },
+           { "temperature", temperature[READ] } };
+}
+
 void Smoke::Update()
 {
   /********** Adding Smoke Origin *********/
@@ -63,33 +58,55 @@ void Smoke::Update()
   const int x = options->simWidth / 2;
   const int y = 75;
 
-  sFact.addSplat(density[READ],           std::make_tuple(x, y), std::make_tuple(0.12f, 0.31f, 0.7f), 0.5f);
-  sFact.addSplat(temperature[READ],       std::make_tuple(x, y), std::make_tuple(rd() * 20.0f + 10.0f, 0.0f, 0.0f), 3.0f);
-  sFact.addSplat(velocitiesTexture[READ], std::make_tuple(x, y), std::make_tuple(2.0f * rd() - 1.0f, 0.0f, 0.0f), 5.0f);
+  // With --fixed-dt, each sub-step emits its share of the step, so a step emits the same
+  // smoke whatever the number of sub-steps
+  const float emission = options->fixedDt > 0.0f ? options->dt / options->fixedDt : 1.0f;
+
+  sFact.addSplat(density[READ],           std::make_tuple(x, y), std::make_tuple(0.12f, 0.31f, 0.7f), 0.5f * emission);
+  sFact.addSplat(temperature[READ],       std::make_tuple(x, y), std::make_tuple(rd() * 20.0f, 0.0f, 0.0f), 3.0f * emission);
+  sFact.addSplat(velocitiesTexture[READ], std::make_tuple(x, y), std::make_tuple(2.0f * rd() - 1.0f, 0.0f, 0.0f), 5.0f * emission);
 
-  float vMax = sFact.maxReduce(velocitiesTexture[READ]);
-  if(vMax > 1e-5f) options->dt = 5.0f / (vMax + options->dt);
+  if(options->activeTiles || sFact.sparseFields()) sFact.updateActiveTiles({ velocitiesTexture[READ], density[READ], temperature[READ] });
+
+  // With --fixed-dt, advanceSimulation() sets the time step
+  if(options->fixedDt <= 0.0f)
+  {
+    float vMax = sFact.maxReduce(velocitiesTexture[READ]);
+    metrics().vMax.set(vMax);
+    if(vMax > 1e-5f) options->dt = options->cfl / (vMax + options->dt);
+  }
+
+  /********** Step Passes **********/
+  // The advected velocities end up in vel[1], and the projection writes them back to vel[0]
+  PassGraph graph;
+  const GLuint vel[2] = { velocitiesTexture[READ], velocitiesTexture[WRITE] };
+  const GLuint proj[2] = { vel[1], vel[0] };
+  const GLuint den[2] = { density[READ], density[WRITE] };
+  const GLuint temp[2] = { temperature[READ], temperature[WRITE] };
 
   /********** Convection **********/
-  //sFact.RKAdvect(velocitiesTexture[READ], velocitiesTexture[READ], velocitiesTexture[WRITE], options->dt);
-  sFact.mcAdvect(velocitiesTexture[READ], velocitiesTexture);
-  std::swap(velocitiesTexture[0], velocitiesTexture[3]);
+  graph.add("advectVelocities", { vel[0] }, { vel[1] }, [this, vel]() { sFact.mcAdvect(vel[0], vel); });
 
   /********** Fields Advection **********/
-  //sFact.RKAdvect(velocitiesTexture[READ], density[READ], density[WRITE], options->dt);
-  sFact.mcAdvect(velocitiesTexture[READ], density);
-  std::swap(density[0], density[3]);
-
-  //sFact.RKAdvect(velocitiesTexture[READ], temperature[READ], temperature[WRITE], options->dt);
-  sFact.mcAdvect(velocitiesTexture[READ], temperature);
-  std::swap(temperature[0], temperature[3]);
+  graph.add("advectDensity", { vel[1], den[0] }, { den[1] }, [this, vel, den]() { sFact.mcAdvect(vel[1], den); });
+  graph.add("advectTemperature", { vel[1], temp[0] }, { temp[1] }, [this, vel, temp]() { sFact.mcAdvect(vel[1], temp); });
 
   /********** Buoyant Force **********/
-  sFact.applyBuoyantForce(velocitiesTexture[READ], temperature[READ], density[READ], 0.25f, 0.1f, 10.0f);
+  graph.add("buoyantForce", { vel[1], temp[1], den[1] }, { vel[1] }, [this, vel, temp, den]()
+  {
+    // The empty grid is at the ambient temperature, so the air outside of the plume is at rest
+    // and left to the active tiles. The source heats the plume above it.
+    sFact.applyBuoyantForce(vel[1], temp[1], den[1], 0.25f, 0.1f, 0.0f);
+  });
+
+  /********** Pressure Projection *********/
+  graph.add("projection", { proj[0] }, { proj[1] }, [this, proj]() { sFact.project(proj); });
+
+  graph.execute();
+  sFact.flushBarriers();
 
-  /********** Red-Black Jacobi for the pressure projection *********/
-  sFact.RBMethod(velocitiesTexture, divRBTexture, pressureRBTexture);
-  std::swap(velocitiesTexture[READ], velocitiesTexture[WRITE]);
+  std::swap(density[READ], density[WRITE]);
+  std::swap(temperature[READ], temperature[WRITE]);
 
   /********** Updating the shared texture **********/
   shared_texture = density[READ];
@@ -18,15 +18,14 @@ class Smoke : public SimulationBase
     void AddSplat() override;
     void AddMultipleSplat(const int nb) override;
     void RemoveSplat() override;
+
+    std::map<std::string, GLuint> Fields() const override;
   private:
     int READ = 0, WRITE = 1;
 
-    GLuint velocitiesTexture[4];
-    GLuint density[4];
-    GLuint temperature[4];
-    GLuint divRBTexture;
-    GLuint pressureRBTexture;
-    GLuint divergenceCurlTexture;
+    GLuint velocitiesTexture[2];
+    GLuint density[2];
+    GLuint temperature[2];
 };
 
 #endif //SMOKE_H
@@ -0,0 +1,27 @@
+#include "TexturePool.h"
+
+TexturePool::~TexturePool()
+{
+  deleteTextures(textures.size(), textures.data());
+}
+
+GLuint TexturePool::acquire(const unsigned width, const unsigned height, const GLenum format, const bool sparse)
+{
+  std::vector<GLuint>& free = freeTextures[std::make_tuple(width, height, format, sparse)];
+  if(!free.empty())
+  {
+    const GLuint tex = free.back();
+    free.pop_back();
+    return tex;
+  }
+
+  const GLuint tex = sparse ? createSparseTexture2D(width, height, format, "transient") : createTexture2D(width, height, format, "transient");
+  textures.push_back(tex);
+  return tex;
+}
+
+void TexturePool::release(const GLuint tex)
+{
+  auto [width, height] = textureSize(tex);
+  freeTextures[std::make_tuple(width, height, textureFormat(tex), textureSparse(tex))].push_back(tex);
+}
@@ -0,0 +1,58 @@
+#ifndef TEXTUREPOOL_H
+#define TEXTUREPOOL_H
+
+/**
+ * @file TexturePool.h
+ * @brief Recycling of the transient textures of the simulation passes
+ */
+
+#include "GLUtils.h"
+
+#include <map>
+#include <tuple>
+#include <vector>
+
+/**
+ * @class TexturePool
+ * @brief Hands out textures that only live for the duration of a pass
+ *
+ * Released textures go back to a free list keyed by their size and format,
+ * and the next request with the same key reuses them. The pool therefore
+ * only grows up to the largest set of transient textures alive at once.
+ */
+class TexturePool
+{
+  public:
+    TexturePool() = default;
+    ~TexturePool();
+
+    TexturePool(const TexturePool&) = delete;
+    TexturePool& operator=(const TexturePool&) = delete;
+
+    /**
+     * Returns a free texture, allocating it if needed. Its content is undefined.
+     * @param width the texture width
+     * @param height the texture height
+     * @param format the sized internal format
+     * @param sparse whether the texture is sparse, with the pages committed by the caller
+     */
+    GLuint acquire(const unsigned width, const unsigned height, const GLenum format = GL_RGBA16F, const bool sparse = false);
+
+    /**
+     * Gives a texture back to the pool once its content is dead
+     * @param tex a texture returned by acquire()
+     */
+    void release(const GLuint tex);
+
+    /**
+     * Number of textures owned by the pool, free or not
+     */
+    std::size_t size() const { return textures.size(); }
+  private:
+    using Key = std::tuple<unsigned, unsigned, GLenum, bool>;
+
+    std::map<Key, std::vector<GLuint>> freeTextures;
+    std::vector<GLuint> textures;
+};
+
+#endif //TEXTUREPOOL_H
@@ -0,0 +1,179 @@
+#include "WorkGroupTuner.h"
+#include "SimulationFactory.h"
+
+#include <cmath>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <vector>
+
+WorkGroupTuner::WorkGroupTuner(const std::string& cachePath)
+  : path(cachePath)
+{
+  device = std::string(reinterpret_cast<const char*>(glGetString(GL_RENDERER))) + " / "
+         + reinterpret_cast<const char*>(glGetString(GL_VERSION));
+
+  std::ifstream file(path);
+  std::string line;
+  while(std::getline(file, line))
+  {
+    std::stringstream ss(line);
+    std::string entryDevice, kernel, grid;
+    unsigned x, y;
+    if(std::getline(ss, entryDevice, '\t') && std::getline(ss, kernel, '\t') && std::getline(ss, grid, '\t') && ss >> x >> y)
+      entries[entryDevice + '\t' + kernel + '\t' + grid] = std::make_tuple(x, y);
+  }
+}
+
+std::string WorkGroupTuner::key(const std::string& kernel, const unsigned width, const unsigned height) const
+{
+  std::stringstream ss;
+  ss << device << '\t' << kernel << '\t' << width << "x" << height;
+  return ss.str();
+}
+
+void WorkGroupTuner::save() const
+{
+  std::ofstream file(path);
+  for(const auto& [k, shape] : entries)
+    file << k << '\t' << std::get<0>(shape) << '\t' << std::get<1>(shape) << std::endl;
+}
+
+void WorkGroupTuner::apply(SimulationFactory& sFact, const unsigned width, const unsigned height, const bool tune)
+{
+  std::vector<std::string> missing;
+  for(const std::string& kernel : sFact.kernelNames())
+  {
+    auto it = entries.find(key(kernel, width, height));
+    if(it != entries.end() && sFact.fitsSharedMemory(kernel, std::get<0>(it->second), std::get<1>(it->second)))
+    {
+      auto [x, y] = it->second;
+      if(sFact.workGroupSize(kernel) != it->second) sFact.setWorkGroupSize(kernel, x, y);
+    }
+    else
+    {
+      missing.push_back(kernel);
+    }
+  }
+
+  if(!tune || missing.empty()) return;
+
+  /********** Synthetic Fields **********/
+  const unsigned pw = (width + 1) / 2, ph = (height + 1) / 2;
+
+  GLuint fields[6], packed[5];
+  // The velocities get the compact format of the simulations
+  for(unsigned i = 0; i < 6; ++i) fields[i] = createTexture2D(width, height, i == 0 ? GL_RG16F : GL_RGBA16F, "autotune");
+  for(GLuint& tex : packed) tex = createTexture2D(pw, ph, GL_RGBA16F, "autotune");
+
+  auto vortex = [width, height](unsigned x, unsigned y)
+  {
+    const float dx = (static_cast<float>(x) - 0.5f * width) / width;
+    const float dy = (static_cast<float>(y) - 0.5f * height) / height;
+    const float s = 50.0f * std::exp(- (dx * dx + dy * dy) / 0.05f);
+    return std::make_tuple(- s * dy, s * dx, 0.0f, 0.0f);
+  };
+
+  auto stripes = [](unsigned x, unsigned y)
+  {
+    return std::make_tuple(0.5f + 0.5f * std::sin(0.05f * x), 0.5f + 0.5f * std::cos(0.05f * y), 0.5f, 1.0f);
+  };
+
+  fillTextureWithFunctor(fields[0], width, height, vortex);
+  for(unsigned i = 2; i < 6; ++i) fillTextureWithFunctor(fields[i], width, height, stripes);
+
+  const GLuint velocities = fields[0], out = fields[1];
+  const GLuint departure = sFact.pool.acquire(width, height, GL_RG32F);
+  const GLuint theta[3] = { fields[3], fields[4], fields[5] };
+
+  /********** Representative call of each kernel **********/
+  const std::map<std::string, std::function<void()>> workloads = {
+    { "copy",                 [&]() { sFact.copy(fields[2], out); } },
+    { "maxReduce",            [&]() { sFact.maxReduce(velocities); } },
+    { "addSmokeSpot",         [&]() { sFact.addSplat(out, std::make_tuple(width / 2, height / 2), std::make_tuple(0.1f, 0.2f, 0.3f), 1.0f); sFact.flushSplats(); } },
+    { "mccormack",            [&]() { sFact.maccormackStep(out, fields[2], fields[3], fields[4], velocities); } },
+    { "RKAdvect",             [&]() { sFact.RKAdvect(velocities, fields[2], out, 0.1f); } },
+    { "departure",            [&]() { sFact.departure(velocities, departure, 0.1f); } },
+    { "divCurl",              [&]() { sFact.divergenceCurl(velocities, out); } },
+    { "divRB",                [&]() { sFact.divergenceRB(velocities, packed[0]); } },
+    { "jacobi",               [&]() { sFact.solvePressure(fields[2], fields[3], out); } },
+    { "jacobiBlack",          [&]() { sFact.jacobiRBPasses(packed[0], packed[1], 1); } },
+    { "jacobiRed",            [&]() { sFact.jacobiRBPasses(packed[0], packed[1], 1); } },
+    { "jacobiRBTiled",        [&]() { sFact.jacobiRBTiled(packed[0], packed[1], 8); } },
+    { "pressure_projection",  [&]() { sFact.pressureProjection(fields[2], velocities, out); } },
+    { "pressureProjectionRB", [&]() { sFact.pressureProjectionRB(packed[1], velocities, out); } },
+    { "residualRB",           [&]() { sFact.residualRB(packed[1], packed[2], packed[0], packed[3], packed[4]); } },
+    { "applyVorticity",       [&]() { sFact.applyVorticity(out, fields[2]); } },
+    { "buoyantForce",         [&]() { sFact.applyBuoyantForce(out, fields[2], fields[3], 0.25f, 0.1f, 10.0f); } },
+    { "bodyForces",           [&]() { sFact.applyBodyForces(velocities, out, fields[2], fields[3], 0.25f, 0.1f, 15.0f); } },
+    { "waterContinuity",      [&]() { sFact.updateQAndTheta(out, theta); } }
+  };
+
+  /********** Candidate shapes within the device limits **********/
+  GLint maxInvocations, maxX, maxY;
+  glGetIntegerv(GL_MAX_COMPUTE_WORK_GROUP_INVOCATIONS, &maxInvocations);
+  glGetIntegeri_v(GL_MAX_COMPUTE_WORK_GROUP_SIZE, 0, &maxX);
+  glGetIntegeri_v(GL_MAX_COMPUTE_WORK_GROUP_SIZE, 1, &maxY);
+
+  std::vector<Shape> candidates;
+  for(Shape shape : { Shape(8, 8), Shape(16, 8), Shape(8, 16), Shape(16, 16), Shape(32, 4),
+                      Shape(32, 8), Shape(64, 4), Shape(32, 16), Shape(64, 8), Shape(32, 32) })
+  {
+    auto [x, y] = shape;
+    if(static_cast<GLint>(x * y) <= maxInvocations && static_cast<GLint>(x) <= maxX && static_cast<GLint>(y) <= maxY)
+      candidates.push_back(shape);
+  }
+
+  const unsigned repetitions = 5;
+  GLuint query;
+  glGenQueries(1, &query);
+
+  for(const std::string& kernel : missing)
+  {
+    auto workload = workloads.find(kernel);
+    if(workload == workloads.end()) continue;
+
+    Shape best = sFact.workGroupSize(kernel);
+    GLuint64 bestTime = std::numeric_limits<GLuint64>::max();
+    for(const Shape& shape : candidates)
+    {
+      auto [x, y] = shape;
+      if(!sFact.fitsSharedMemory(kernel, x, y)) continue;
+
+      sFact.setWorkGroupSize(kernel, x, y);
+
+      // Warm-up call to exclude the lazy driver work from the measurement
+      workload->second();
+      glFinish();
+
+      glBeginQuery(GL_TIME_ELAPSED, query);
+      for(unsigned i = 0; i < repetitions; ++i) workload->second();
+      glEndQuery(GL_TIME_ELAPSED);
+
+      GLuint64 elapsed;
+      glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed);
+      if(elapsed < bestTime)
+      {
+        bestTime = elapsed;
+        best = shape;
+      }
+    }
+
+    auto [x, y] = best;
+    sFact.setWorkGroupSize(kernel, x, y);
+    entries[key(kernel, width, height)] = best;
+
+    std::cout << "Work group size of " << kernel << ": " << x << "x" << y
+              << " (" << bestTime / 1000000.0 / repetitions << " ms)" << std::endl;
+  }
+
+  glDeleteQueries(1, &query);
+  deleteTextures(6, fields);
+  deleteTextures(5, packed);
+  sFact.pool.release(departure);
+  sFact.resetTraffic();
+
+  save();
+}
@@ -0,0 +1,54 @@
+#ifndef WORKGROUPTUNER_H
+#define WORKGROUPTUNER_H
+
+/**
+ * @file WorkGroupTuner.h
+ * @brief Selection of the work group shape of each compute kernel
+ */
+
+#include "GLUtils.h"
+
+#include <map>
+#include <string>
+#include <tuple>
+
+class SimulationFactory;
+
+/**
+ * @class WorkGroupTuner
+ * @brief Measures the best work group shape per device, kernel and grid size
+ *
+ * The measured shapes are kept in a plain text cache, one line per entry with
+ * the tab separated device, kernel, grid size and local sizes. A device only
+ * pays for the measurements once per grid size.
+ */
+class WorkGroupTuner
+{
+  public:
+    /**
+     * Loads the cache
+     * @param cachePath path of the cache file, which does not need to exist
+     */
+    WorkGroupTuner(const std::string& cachePath);
+
+    /**
+     * Applies the cached shapes to the kernels of the factory
+     * @param sFact the factory owning the kernels
+     * @param width the grid width
+     * @param height the grid height
+     * @param tune measure and store the kernels missing from the cache
+     */
+    void apply(SimulationFactory& sFact, const unsigned width, const unsigned height, const bool tune);
+
+  private:
+    using Shape = std::tuple<unsigned, unsigned>;
+
+    std::string key(const std::string& kernel, const unsigned width, const unsigned height) const;
+    void save() const;
+
+    std::string path;
+    std::string device;
+    std::map<std::string, Shape> entries;
+};
+
+#endif //WORKGROUPTUNER_H
@@ -1,8 +1,6 @@
 #include "ProgramOptions.h"
 #include "GLFWHandler.h"
-#include "SimpleFluid.h"
-#include "Smoke.h"
-#include "Clouds.h"
+#include "Simulations.h"
 
 int main(int argc, char** argv)
 {
@@ -12,28 +10,13 @@ int main(int argc, char** argv)
 
   GLFWHandler handler(&options);
 
+  applyMemoryBudget(&options, &handler);
+
   /*********** SIMULATION CHOICE ***********/
-  SimulationBase *sim;
-  switch(options.simType)
-  {
-    case SPLATS:
-    {
-      sim = new SimpleFluid(&options, &handler);
-      break;
-    }
-    case SMOKE:
-    {
-      sim = new Smoke(&options, &handler);
-      break;
-    }
-    case CLOUDS:
-    {
-      sim = new Clouds(&options, &handler);
-      break;
-    }
-  }
+  SimulationBase *sim = createSimulation(&options, &handler);
   
   handler.attachSimulation(sim);
+  loadInitialConditions(sim);
   handler.run();
 
   return 0;
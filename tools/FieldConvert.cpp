@@ -0,0 +1,139 @@
+#include "FieldFile.h"
+#include "HalfFloat.h"
+#include "lodepng.h"
+
+#include <boost/program_options.hpp>
+
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/********** Conversion Configuration **********/
+struct ConvertOptions
+{
+  std::string input;
+  std::string output;
+  std::string field;
+  unsigned channels;
+  float scale;
+  float offset;
+  FieldType type;
+};
+
+ConvertOptions parseConvertOptions(int argc, char* argv[])
+{
+  namespace po = boost::program_options;
+
+  ConvertOptions options;
+  std::string format;
+
+  po::options_description po_options("field_convert [options]");
+  po_options.add_options()
+    ("input,i", po::value<std::string>(&options.input)->required(), "PNG image, whose size is the one of the grid")
+    ("output,o", po::value<std::string>(&options.output)->required(), "field file to write")
+    ("field", po::value<std::string>(&options.field)->default_value("density"), "field of the image, which sets the defaults below (velocities, density, temperature, obstacles)")
+    ("channels", po::value<unsigned>(&options.channels), "channels of the field, taken from the red, green, blue and alpha of the image (velocities: 2, density: 4, others: 1)")
+    ("scale", po::value<float>(&options.scale), "the texels are offset + scale * c, with c the 8 bits channel in [0, 1] (velocities: 2, others: 1)")
+    ("offset", po::value<float>(&options.offset), "see scale (velocities: -1, others: 0)")
+    ("format", po::value<std::string>(&format)->default_value("fp16"), "precision of the texels (fp16, fp32)")
+    ("help,h", "display this message")
+  ;
+
+  try
+  {
+    po::variables_map vm;
+    po::store(po::command_line_parser(argc, argv).options(po_options).run(), vm);
+
+    if(vm.count("help"))
+    {
+      std::cout << po_options;
+      std::exit(0);
+    }
+
+    po::notify(vm);
+
+    if(options.field != "velocities" && options.field != "density"
+        && options.field != "temperature" && options.field != "obstacles")
+      throw std::invalid_argument("bad field " + options.field);
+
+    if(format == "fp16") options.type = FIELD_FP16;
+    else if(format == "fp32") options.type = FIELD_FP32;
+    else throw std::invalid_argument("bad format " + format);
+
+    const bool velocities = options.field == "velocities";
+    if(!vm.count("channels")) options.channels = velocities ? 2 : options.field == "density" ? 4 : 1;
+    if(!vm.count("scale")) options.scale = velocities ? 2.0f : 1.0f;
+    if(!vm.count("offset")) options.offset = velocities ? -1.0f : 0.0f;
+
+    if(options.channels != 1 && options.channels != 2 && options.channels != 4)
+      throw std::invalid_argument("the fields have 1, 2 or 4 channels");
+  }
+  catch (std::exception& ex)
+  {
+    std::cout << ex.what() << std::endl;
+    std::cout << po_options;
+    std::exit(1);
+  }
+
+  return options;
+}
+
+int main(int argc, char** argv)
+{
+  const ConvertOptions options = parseConvertOptions(argc, argv);
+
+  std::vector<unsigned char> image;
+  unsigned width, height;
+  unsigned error = lodepng::decode(image, width, height, options.input);
+  if(error)
+  {
+    std::cout << "Decode Error: " << error << ": " << lodepng_error_text(error) << std::endl;
+    return 1;
+  }
+
+  std::ofstream file(options.output, std::ios::binary);
+  if(!file)
+  {
+    std::cout << "Cannot write " << options.output << std::endl;
+    return 1;
+  }
+
+  const FieldHeader header = fieldHeader(width, height, options.channels, options.type);
+  file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+  // The image is stored from its top row, and the fields from the bottom of the grid
+  const bool obstacles = options.field == "obstacles";
+  std::vector<float> row(width * options.channels);
+  std::vector<std::uint16_t> halves(row.size());
+  for(unsigned y = 0; y < height; ++y)
+  {
+    const unsigned char *pixels = image.data() + 4 * static_cast<std::size_t>(height - 1 - y) * width;
+    for(unsigned x = 0; x < width; ++x)
+    {
+      for(unsigned c = 0; c < options.channels; ++c)
+      {
+        const float value = options.offset + options.scale * pixels[4 * x + c] / 255.0f;
+        row[x * options.channels + c] = obstacles ? (value > 0.5f ? 1.0f : 0.0f) : value;
+      }
+    }
+
+    if(options.type == FIELD_FP16)
+    {
+      floatToHalf(row.data(), halves.data(), row.size());
+      file.write(reinterpret_cast<const char*>(halves.data()), halves.size() * sizeof(std::uint16_t));
+    }
+    else file.write(reinterpret_cast<const char*>(row.data()), row.size() * sizeof(float));
+  }
+
+  if(!file)
+  {
+    std::cout << "Cannot write " << options.output << std::endl;
+    return 1;
+  }
+
+  std::cout << "Wrote the " << width << "x" << height << " " << options.field << " field to " << options.output << std::endl;
+
+  return 0;
+}
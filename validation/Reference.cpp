@@ -0,0 +1,571 @@
+#include "Reference.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+namespace reference
+{
+  /********** Field Access **********/
+  Vec4 Field::clamped(int x, int y) const
+  {
+    x = std::clamp(x, 0, static_cast<int>(width) - 1);
+    y = std::clamp(y, 0, static_cast<int>(height) - 1);
+    const std::size_t pos = 4 * (static_cast<std::size_t>(y) * width + x);
+    return { data[pos], data[pos + 1], data[pos + 2], data[pos + 3] };
+  }
+
+  Vec4 Field::fetch(int x, int y) const
+  {
+    if(x < 0 || y < 0 || x >= static_cast<int>(width) || y >= static_cast<int>(height))
+      return { 0.0, 0.0, 0.0, 0.0 };
+
+    return clamped(x, y);
+  }
+
+  void Field::set(const unsigned x, const unsigned y, const Vec4& v)
+  {
+    const std::size_t pos = 4 * (static_cast<std::size_t>(y) * width + x);
+    std::copy(v.begin(), v.end(), data.begin() + pos);
+  }
+
+  static Vec4 mix(const Vec4& a, const Vec4& b, const double t)
+  {
+    return { a[0] + t * (b[0] - a[0]), a[1] + t * (b[1] - a[1]),
+             a[2] + t * (b[2] - a[2]), a[3] + t * (b[3] - a[3]) };
+  }
+
+  /********** Interpolation **********/
+  Vec4 bilinear(const Field& f, const double px, const double py)
+  {
+    const double ix = std::floor(px), iy = std::floor(py);
+    const double fx = px - ix, fy = py - iy;
+    const int x = static_cast<int>(ix), y = static_cast<int>(iy);
+
+    return mix(mix(f.clamped(x, y    ), f.clamped(x + 1, y    ), fx),
+               mix(f.clamped(x, y + 1), f.clamped(x + 1, y + 1), fx), fy);
+  }
+
+  std::array<double, 2> RK(const Field& velocities, const double px, const double py, const double dt)
+  {
+    const Vec4 v1 = bilinear(velocities, px, py);
+    const Vec4 v2 = bilinear(velocities, px + 0.5 * v1[0] * dt, py + 0.5 * v1[1] * dt);
+    const Vec4 v3 = bilinear(velocities, px + 0.5 * v2[0] * dt, py + 0.5 * v2[1] * dt);
+    const Vec4 v4 = bilinear(velocities, px + v3[0] * dt, py + v3[1] * dt);
+
+    return { (v1[0] + 2.0 * (v2[0] + v3[0]) + v4[0]) / 6.0,
+             (v1[1] + 2.0 * (v2[1] + v3[1]) + v4[1]) / 6.0 };
+  }
+
+  /********** Advection **********/
+  Field RKAdvect(const Field& velocities, const Field& field, const double dt)
+  {
+    Field out(field.width, field.height);
+    for(unsigned y = 0; y < field.height; ++y)
+    {
+      for(unsigned x = 0; x < field.width; ++x)
+      {
+        const auto v = RK(velocities, x, y, dt);
+        out.set(x, y, bilinear(field, x - dt * v[0], y - dt * v[1]));
+      }
+    }
+
+    return out;
+  }
+
+  Field maccormackStep(const Field& field_n, const Field& field_n_1, const Field& field_n_hat,
+      const Field& velocities, const double dt, const double revert, Mask *ambiguous)
+  {
+    // The GPU fields are fp16, so the values it computes are only known to about two
+    // roundings of 11 bits of their inputs
+    const double precision = std::ldexp(1.0, -10);
+
+    // Cells flagged by the earlier passes of the step, counted in a summed area table. The
+    // advected velocities may differ on the GPU there, which moves the backtraces through them.
+    const unsigned w = field_n.width, h = field_n.height;
+    std::vector<unsigned> upstream;
+    if(ambiguous)
+    {
+      upstream.assign(static_cast<std::size_t>(w + 1) * (h + 1), 0);
+      for(unsigned y = 0; y < h; ++y)
+        for(unsigned x = 0; x < w; ++x)
+          upstream[(y + 1) * (w + 1) + x + 1] = (*ambiguous)[static_cast<std::size_t>(y) * w + x]
+            + upstream[y * (w + 1) + x + 1] + upstream[(y + 1) * (w + 1) + x] - upstream[y * (w + 1) + x];
+    }
+
+    auto upstreamIn = [&](const int x0, const int y0, const int x1, const int y1)
+    {
+      const unsigned ax = std::clamp(x0, 0, static_cast<int>(w)), ay = std::clamp(y0, 0, static_cast<int>(h));
+      const unsigned bx = std::clamp(x1 + 1, 0, static_cast<int>(w)), by = std::clamp(y1 + 1, 0, static_cast<int>(h));
+      if(ax >= bx || ay >= by) return false;
+      return upstream[by * (w + 1) + bx] + upstream[ay * (w + 1) + ax] > upstream[ay * (w + 1) + bx] + upstream[by * (w + 1) + ax];
+    };
+
+    Field out(field_n.width, field_n.height);
+    for(unsigned y = 0; y < field_n.height; ++y)
+    {
+      for(unsigned x = 0; x < field_n.width; ++x)
+      {
+        const Vec4 qAdv = field_n_1.clamped(x, y);
+        const Vec4 n = field_n.clamped(x, y);
+        const Vec4 nHat = field_n_hat.clamped(x, y);
+
+        const auto v = RK(velocities, x, y, dt);
+        const double px = x - dt * v[0], py = y - dt * v[1];
+        const int nx = static_cast<int>(std::floor(px));
+        const int ny = static_cast<int>(std::floor(py));
+
+        Vec4 r;
+        for(int k = 0; k < 4; ++k) r[k] = qAdv[k] + 0.5 * n[k] - 0.5 * nHat[k];
+
+        // Clamps r to the 2x2 neighborhood from (cx, cy), and returns the clamp distance. Its
+        // range for the precision of the GPU is returned in low and high.
+        auto clampTo = [&](const int cx, const int cy, Vec4& rClamped, double& low, double& high)
+        {
+          const Vec4 a = field_n.clamped(cx, cy), b = field_n.clamped(cx + 1, cy);
+          const Vec4 c = field_n.clamped(cx, cy + 1), d = field_n.clamped(cx + 1, cy + 1);
+
+          double distance = 0.0;
+          low = high = 0.0;
+          for(int k = 0; k < 4; ++k)
+          {
+            const double vMin = std::min(std::min(std::min(a[k], b[k]), c[k]), d[k]);
+            const double vMax = std::max(std::max(std::max(a[k], b[k]), c[k]), d[k]);
+            rClamped[k] = std::clamp(r[k], vMin, vMax);
+            distance += (rClamped[k] - r[k]) * (rClamped[k] - r[k]);
+
+            const double outside = std::max(r[k] - vMax, vMin - r[k]);
+            const double error = precision * (std::abs(qAdv[k]) + 0.5 * std::abs(n[k]) + 0.5 * std::abs(nHat[k])
+                                              + std::max(std::abs(vMin), std::abs(vMax)));
+            low += std::pow(std::max(outside - error, 0.0), 2);
+            high += std::pow(std::max(outside + error, 0.0), 2);
+          }
+
+          low = std::sqrt(low);
+          high = std::sqrt(high);
+          return std::sqrt(distance);
+        };
+
+        Vec4 rClamped;
+        double low, high;
+        const Vec4 corrected = clampTo(nx, ny, rClamped, low, high) > revert ? qAdv : rClamped;
+        out.set(x, y, corrected);
+
+        if(!ambiguous) continue;
+
+        // The limiter jumps when the clamp distance crosses the revert threshold, and when
+        // a departure point crosses a cell edge, which changes the clamp neighborhood
+        std::vector<Vec4> outcomes;
+        auto addOutcomes = [&](const int cx, const int cy)
+        {
+          Vec4 other;
+          double otherLow, otherHigh;
+          clampTo(cx, cy, other, otherLow, otherHigh);
+          if(otherLow <= revert) outcomes.push_back(other);
+          if(otherHigh > revert) outcomes.push_back(qAdv);
+        };
+
+        addOutcomes(nx, ny);
+
+        const double edgeMargin = precision * (std::abs(dt * v[0]) + std::abs(dt * v[1]) + 1.0);
+        const double ex = std::round(px), ey = std::round(py);
+        if(std::abs(px - ex) < edgeMargin) addOutcomes(nx == ex ? nx - 1 : nx + 1, ny);
+        if(std::abs(py - ey) < edgeMargin) addOutcomes(nx, ny == ey ? ny - 1 : ny + 1);
+
+        // Outcomes within the rounding of the GPU are the same
+        bool jumps = false;
+        for(const Vec4& outcome : outcomes)
+        {
+          for(int k = 0; k < 4; ++k)
+          {
+            const double magnitude = std::max(std::abs(outcome[k]), std::abs(corrected[k]));
+            jumps = jumps || std::abs(outcome[k] - corrected[k]) > 4.0 * precision * std::max(magnitude, 1.0);
+          }
+        }
+
+        // The forward pass samples the velocities up to dt |v| away from the cell on either side
+        // (see RK), and the backward pass samples forward results that are as far again
+        const int rx = static_cast<int>(std::ceil(2.0 * std::abs(dt * v[0]))) + 2;
+        const int ry = static_cast<int>(std::ceil(2.0 * std::abs(dt * v[1]))) + 2;
+        jumps = jumps || upstreamIn(x - rx, y - ry, x + rx, y + ry);
+
+        if(jumps) (*ambiguous)[static_cast<std::size_t>(y) * field_n.width + x] = true;
+      }
+    }
+
+    return out;
+  }
+
+  std::array<Field, 3> mcAdvect(const Field& velocities, const Field& field, const double dt, const double revert, Mask *ambiguous)
+  {
+    Field forward = RKAdvect(velocities, field, dt);
+    Field backward = RKAdvect(velocities, forward, - dt);
+    Field corrected = maccormackStep(field, forward, backward, velocities, dt, revert, ambiguous);
+
+    return { forward, backward, corrected };
+  }
+
+  /********** Forces **********/
+  void addSplat(Field& field, const int sx, const int sy, const std::array<double, 3>& color, const double intensity)
+  {
+    // Same square cut as SimulationFactory::addSplat, where the Gaussian falls under 1e-4
+    const float peak = static_cast<float>(intensity) * std::max({ std::abs(static_cast<float>(color[0])),
+      std::abs(static_cast<float>(color[1])), std::abs(static_cast<float>(color[2])) });
+    if(peak <= 1e-4f) return;
+
+    const int radius = static_cast<int>(std::ceil(std::sqrt(200.0f * std::log(peak / 1e-4f))));
+    for(unsigned y = 0; y < field.height; ++y)
+    {
+      for(unsigned x = 0; x < field.width; ++x)
+      {
+        const double px = static_cast<int>(x) - sx, py = static_cast<int>(y) - sy;
+        if(std::abs(px) > radius || std::abs(py) > radius) continue;
+
+        const double s = intensity * std::exp(- (px * px + py * py) / 200.0);
+        const Vec4 base = field.clamped(x, y);
+        field.set(x, y, { base[0] + s * color[0], base[1] + s * color[1], base[2] + s * color[2], 1.0 });
+      }
+    }
+  }
+
+  void applyBuoyantForce(Field& velocities, const Field& temperature, const Field& density,
+      const double dt, const double kappa, const double sigma, const double t0)
+  {
+    for(unsigned y = 0; y < velocities.height; ++y)
+    {
+      for(unsigned x = 0; x < velocities.width; ++x)
+      {
+        const double t = temperature.clamped(x, y)[0];
+        const double d = density.clamped(x, y)[0];
+        Vec4 v = velocities.clamped(x, y);
+        v[1] += dt * (- kappa * d + sigma * (t - t0));
+        velocities.set(x, y, v);
+      }
+    }
+  }
+
+  Field divergenceCurl(const Field& velocities)
+  {
+    const int w = velocities.width, h = velocities.height;
+    Field out(w, h);
+    for(int y = 0; y < h; ++y)
+    {
+      for(int x = 0; x < w; ++x)
+      {
+        Vec4 L = velocities.fetch(x - 1, y), R = velocities.fetch(x + 1, y);
+        Vec4 B = velocities.fetch(x, y - 1), T = velocities.fetch(x, y + 1);
+        const Vec4 C = velocities.fetch(x, y);
+        if(x == 0) L[0] = - C[0];
+        if(y == 0) B[1] = - C[1];
+        if(x >= w - 1) R[0] = - C[0];
+        if(y >= h - 1) T[1] = - C[1];
+
+        const double div = 0.5 * (R[0] - L[0] + T[1] - B[1]);
+        const double curl = 0.5 * (R[1] - L[1] - T[0] + B[0]);
+        out.set(x, y, { div, curl, 0.0, 0.0 });
+      }
+    }
+
+    return out;
+  }
+
+  void applyVorticity(Field& velocities, const Field& curl, const double dt)
+  {
+    const int w = velocities.width, h = velocities.height;
+    for(int y = 0; y < h; ++y)
+    {
+      for(int x = 0; x < w; ++x)
+      {
+        const double vC = curl.fetch(x, y)[1];
+        const double vL = x == 0 ? vC : curl.fetch(x - 1, y)[1];
+        const double vR = x >= w - 1 ? vC : curl.fetch(x + 1, y)[1];
+        const double vB = y == 0 ? vC : curl.fetch(x, y - 1)[1];
+        const double vT = y >= h - 1 ? vC : curl.fetch(x, y + 1)[1];
+
+        double fx = 0.5 * (std::abs(vT) - std::abs(vB));
+        double fy = 0.5 * (std::abs(vR) - std::abs(vL));
+        const double norm = 1e-10 + std::sqrt(fx * fx + fy * fy);
+        fx *= vC / norm;
+        fy *= - vC / norm;
+
+        Vec4 v = velocities.clamped(x, y);
+        v[0] += dt * fx;
+        v[1] += dt * fy;
+        velocities.set(x, y, v);
+      }
+    }
+  }
+
+  void updateQAndTheta(Field& q, Field& theta, const Field& advectedTheta)
+  {
+    const double G = 9.80665, P0 = 101325.0, T0 = 290.0, LAPSE_RATE = 10.0;
+    const double RD = 287.0, kappa = 0.286, L = 2.501;
+
+    for(unsigned y = 0; y < q.height; ++y)
+    {
+      const double z = static_cast<double>(y) / advectedTheta.height;
+      const double p = P0 * std::pow(1.0 - z * LAPSE_RATE / T0, G / (LAPSE_RATE / RD));
+      const double exner = std::pow(P0 / p, kappa);
+
+      for(unsigned x = 0; x < q.width; ++x)
+      {
+        Vec4 qv = q.clamped(x, y);
+        const Vec4 th = theta.clamped(x, y);
+
+        double t = exner / th[0];
+        double qvs = (380.16 / p) * std::exp(17.67 * t / (t + 243.5));
+        // fmin ignores the NaN of cells without temperature, like the GPU min
+        double deltaQ = std::fmin(qvs - qv[0], qv[1]);
+        qv[0] += deltaQ;
+        qv[1] -= deltaQ;
+
+        Vec4 thetaAdv = advectedTheta.clamped(x, y);
+        t = exner / thetaAdv[0];
+        qvs = (380.16 / p) * std::exp(17.67 * t / (t + 243.5));
+        deltaQ = std::fmin(qvs - qv[0], qv[1]);
+        thetaAdv[0] += (RD * L / kappa) * exner * deltaQ;
+
+        q.set(x, y, qv);
+        theta.set(x, y, thetaAdv);
+      }
+    }
+  }
+
+  /********** Red-Black Pressure Solve **********/
+  static Vec4 mirrorPadding(Vec4 C, const Vec4& L, const Vec4& B, const bool paddedX, const bool paddedY)
+  {
+    if(paddedX) { C[1] = L[1]; C[2] = L[2]; }
+    if(paddedY) { C[2] = B[2]; C[3] = B[3]; }
+    return C;
+  }
+
+  Field divergenceRB(const Field& velocities)
+  {
+    const int w = velocities.width;
+    const int h = velocities.height;
+    Field out((w + 1) / 2, (h + 1) / 2);
+    for(int y = 0; y < static_cast<int>(out.height); ++y)
+    {
+      for(int x = 0; x < static_cast<int>(out.width); ++x)
+      {
+        const int px = 2 * x, py = 2 * y;
+        auto v = [&](int dx, int dy) { return velocities.fetch(px + dx, py + dy); };
+
+        Vec4 f11 = v(0, 0), f22 = v(1, 1), f21 = v(1, 0), f12 = v(0, 1);
+        Vec4 f01 = v(-1, 0), f10 = v(0, -1), f20 = v(1, -1), f02 = v(-1, 1);
+        Vec4 f13 = v(0, 2), f23 = v(1, 2), f31 = v(2, 0), f32 = v(2, 1);
+
+        if(x == 0) { f01[0] = - f11[0]; f02[0] = - f12[0]; }
+        if(y == 0) { f10[1] = - f11[1]; f20[1] = - f21[1]; }
+        if(px + 1 >= w - 1) { f31[0] = - f21[0]; f32[0] = - f22[0]; }
+        if(py + 1 >= h - 1) { f13[1] = - f12[1]; f23[1] = - f22[1]; }
+
+        const bool paddedX = px + 1 >= w, paddedY = py + 1 >= h;
+        if(paddedX) { f21[0] = - f11[0]; f22[0] = - f12[0]; }
+        if(paddedY) { f12[1] = - f11[1]; f22[1] = - f21[1]; }
+
+        out.set(x, y, { 0.5 * (f21[0] - f01[0] + f12[1] - f10[1]),
+                        paddedX ? 0.0 : 0.5 * (f31[0] - f11[0] + f22[1] - f20[1]),
+                        paddedX || paddedY ? 0.0 : 0.5 * (f32[0] - f12[0] + f23[1] - f21[1]),
+                        paddedY ? 0.0 : 0.5 * (f22[0] - f02[0] + f13[1] - f11[1]) });
+      }
+    }
+
+    return out;
+  }
+
+  void jacobiRB(const Field& divergence, Field& pressure, const unsigned iterations, const unsigned width, const unsigned height)
+  {
+    for(unsigned i = 0; i < iterations; ++i)
+    {
+      Field black = pressure;
+      for(unsigned y = 0; y < pressure.height; ++y)
+      {
+        for(unsigned x = 0; x < pressure.width; ++x)
+        {
+          const Vec4 d = divergence.clamped(x, y);
+          const Vec4 old = pressure.clamped(x, y);
+          const Vec4 L = pressure.clamped(x - 1, y), R = pressure.clamped(x + 1, y);
+          const Vec4 B = pressure.clamped(x, y - 1), T = pressure.clamped(x, y + 1);
+          const Vec4 C = mirrorPadding(old, L, B, 2 * x + 1 >= width, 2 * y + 1 >= height);
+
+          black.set(x, y, { 0.25 * (L[1] + C[1] + B[3] + C[3] - d[0]), old[1],
+                            0.25 * (C[3] + R[3] + C[1] + T[1] - d[2]), old[3] });
+        }
+      }
+
+      for(unsigned y = 0; y < pressure.height; ++y)
+      {
+        for(unsigned x = 0; x < pressure.width; ++x)
+        {
+          const Vec4 d = divergence.clamped(x, y);
+          const Vec4 old = black.clamped(x, y);
+          const Vec4 L = black.clamped(x - 1, y), R = black.clamped(x + 1, y);
+          const Vec4 B = black.clamped(x, y - 1), T = black.clamped(x, y + 1);
+          const Vec4 C = mirrorPadding(old, L, B, 2 * x + 1 >= width, 2 * y + 1 >= height);
+
+          pressure.set(x, y, { old[0], 0.25 * (C[0] + R[0] + B[2] + C[2] - d[1]),
+                               old[2], 0.25 * (L[2] + C[2] + T[0] + C[0] - d[3]) });
+        }
+      }
+    }
+  }
+
+  Field pressureProjectionRB(const Field& pressure, const Field& velocities)
+  {
+    Field out(velocities.width, velocities.height);
+    for(unsigned y = 0; y < pressure.height; ++y)
+    {
+      for(unsigned x = 0; x < pressure.width; ++x)
+      {
+        const unsigned px = 2 * x, py = 2 * y;
+        const bool paddedX = px + 1 >= velocities.width, paddedY = py + 1 >= velocities.height;
+
+        const Vec4 L = pressure.clamped(x - 1, y), R = pressure.clamped(x + 1, y);
+        const Vec4 B = pressure.clamped(x, y - 1), T = pressure.clamped(x, y + 1);
+        const Vec4 C = mirrorPadding(pressure.clamped(x, y), L, B, paddedX, paddedY);
+
+        const Vec4 rVel = velocities.clamped(px, py), gVel = velocities.clamped(px + 1, py);
+        const Vec4 bVel = velocities.clamped(px + 1, py + 1), aVel = velocities.clamped(px, py + 1);
+
+        out.set(px, py, { rVel[0] - 0.5 * (C[1] - L[1]), rVel[1] - 0.5 * (C[3] - B[3]), 0.0, 0.0 });
+        if(!paddedX)
+          out.set(px + 1, py, { gVel[0] - 0.5 * (R[0] - C[0]), gVel[1] - 0.5 * (C[2] - B[2]), 0.0, 0.0 });
+        if(!paddedX && !paddedY)
+          out.set(px + 1, py + 1, { bVel[0] - 0.5 * (R[3] - C[3]), bVel[1] - 0.5 * (T[1] - C[1]), 0.0, 0.0 });
+        if(!paddedY)
+          out.set(px, py + 1, { aVel[0] - 0.5 * (C[2] - L[2]), aVel[1] - 0.5 * (T[0] - C[0]), 0.0, 0.0 });
+      }
+    }
+
+    return out;
+  }
+
+  /********** Full Resolution Pressure Solve **********/
+  Field jacobi(const Field& divergence, const Field& pressure)
+  {
+    const int w = pressure.width, h = pressure.height;
+    Field out(w, h);
+    for(int y = 0; y < h; ++y)
+    {
+      for(int x = 0; x < w; ++x)
+      {
+        const double pC = pressure.fetch(x, y)[0];
+        const double pL = x == 0 ? pC : pressure.fetch(x - 1, y)[0];
+        const double pR = x == w - 1 ? pC : pressure.fetch(x + 1, y)[0];
+        const double pB = y == 0 ? pC : pressure.fetch(x, y - 1)[0];
+        const double pT = y == h - 1 ? pC : pressure.fetch(x, y + 1)[0];
+
+        out.set(x, y, { 0.25 * (pL + pR + pB + pT - divergence.fetch(x, y)[0]), 0.0, 0.0, 1.0 });
+      }
+    }
+
+    return out;
+  }
+
+  Field pressureProjection(const Field& pressure, const Field& velocities)
+  {
+    const int w = velocities.width, h = velocities.height;
+    Field out(w, h);
+    for(int y = 0; y < h; ++y)
+    {
+      for(int x = 0; x < w; ++x)
+      {
+        const double pC = pressure.fetch(x, y)[0];
+        const double pL = x == 0 ? pC : pressure.fetch(x - 1, y)[0];
+        const double pR = x >= w - 1 ? pC : pressure.fetch(x + 1, y)[0];
+        const double pB = y == 0 ? pC : pressure.fetch(x, y - 1)[0];
+        const double pT = y >= h - 1 ? pC : pressure.fetch(x, y + 1)[0];
+
+        const Vec4 v = velocities.fetch(x, y);
+        out.set(x, y, { v[0] - 0.5 * (pR - pL), v[1] - 0.5 * (pT - pB), 0.0, 0.0 });
+      }
+    }
+
+    return out;
+  }
+
+  /********** Simulation Steps **********/
+  void project(State& state, const PressureSolverType solver, const unsigned jacobiIterations)
+  {
+    Field& velocities = state["velocities"];
+    if(solver == JACOBI)
+    {
+      const Field divergence = divergenceCurl(velocities);
+      Field pressure(velocities.width, velocities.height);
+      for(unsigned k = 0; k < jacobiIterations; ++k) pressure = jacobi(divergence, pressure);
+      velocities = pressureProjection(pressure, velocities);
+    }
+    else
+    {
+      // The refinement passes of the mixed solver add up to the same Red-Black iterations,
+      // and the CPU solver runs the Red-Black kernels
+      Field divergence = divergenceRB(velocities);
+      Field pressure(divergence.width, divergence.height);
+      jacobiRB(divergence, pressure, jacobiIterations, velocities.width, velocities.height);
+      velocities = pressureProjectionRB(pressure, velocities);
+    }
+  }
+
+  void simpleFluidStep(State& state, const double dt, const double revert, const PressureSolverType solver, const unsigned jacobiIterations,
+      Mask *ambiguous)
+  {
+    Field& velocities = state["velocities"];
+    velocities = mcAdvect(velocities, velocities, dt, revert, ambiguous)[2];
+    state["density"] = mcAdvect(velocities, state["density"], dt, revert, ambiguous)[2];
+
+    project(state, solver, jacobiIterations);
+  }
+
+  void smokeStep(State& state, const double dt, const double revert, const PressureSolverType solver, const unsigned jacobiIterations,
+      Mask *ambiguous)
+  {
+    auto rd = []() -> double
+    {
+      return (double) rand() / (double) RAND_MAX;
+    };
+
+    Field& velocities = state["velocities"];
+    Field& density = state["density"];
+    Field& temperature = state["temperature"];
+
+    const int x = velocities.width / 2;
+    const int y = 75;
+
+    addSplat(density, x, y, { 0.12f, 0.31f, 0.7f }, 0.5f);
+    addSplat(temperature, x, y, { static_cast<float>(rd() * 20.0f), 0.0f, 0.0f }, 3.0f);
+    addSplat(velocities, x, y, { static_cast<float>(2.0f * rd() - 1.0f), 0.0f, 0.0f }, 5.0f);
+
+    velocities = mcAdvect(velocities, velocities, dt, revert, ambiguous)[2];
+    density = mcAdvect(velocities, density, dt, revert, ambiguous)[2];
+    temperature = mcAdvect(velocities, temperature, dt, revert, ambiguous)[2];
+
+    applyBuoyantForce(velocities, temperature, density, dt, 0.25, 0.1, 0.0);
+
+    project(state, solver, jacobiIterations);
+  }
+
+  void cloudsStep(State& state, const double dt, const double revert, const PressureSolverType solver, const unsigned jacobiIterations,
+      Mask *ambiguous)
+  {
+    Field& velocities = state["velocities"];
+    Field& density = state["density"];
+    Field& temperature = state["temperature"];
+
+    velocities = mcAdvect(velocities, velocities, dt, revert, ambiguous)[2];
+    density = mcAdvect(velocities, density, dt, revert, ambiguous)[2];
+    auto advectedTemperature = mcAdvect(velocities, temperature, dt, revert, ambiguous);
+    temperature = advectedTemperature[2];
+
+    applyBuoyantForce(velocities, temperature, density, dt, 0.25, 0.1, 15.0);
+
+    const Field divCurl = divergenceCurl(velocities);
+    applyVorticity(velocities, divCurl, dt);
+
+    // The thermodynamics update writes the backward advected temperature,
+    // which is a scratch texture on the GPU side
+    updateQAndTheta(density, advectedTemperature[1], temperature);
+
+    project(state, solver, jacobiIterations);
+  }
+}
@@ -0,0 +1,113 @@
+#ifndef REFERENCE_H
+#define REFERENCE_H
+
+/**
+ * @file Reference.h
+ * @brief Plain fp64 CPU implementation of the simulation steps
+ *
+ * Each function mirrors the compute shader of the same name, including its
+ * boundary handling, so that the GPU results can be compared field by field.
+ */
+
+#include "ProgramOptions.h"
+
+#include <array>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace reference
+{
+  using Vec4 = std::array<double, 4>;
+
+  /**
+   * @class Field
+   * @brief A RGBA grid of doubles, stored row by row like the GPU textures
+   */
+  struct Field
+  {
+    Field() : width(0), height(0) {}
+    Field(const unsigned width, const unsigned height)
+      : width(width), height(height), data(4 * static_cast<std::size_t>(width) * height, 0.0) {}
+
+    /**
+     * Texel with clamp-to-edge addressing (the sampler behaviour)
+     */
+    Vec4 clamped(int x, int y) const;
+
+    /**
+     * Texel with zero outside of the grid (robust texelFetch behaviour)
+     */
+    Vec4 fetch(int x, int y) const;
+
+    void set(const unsigned x, const unsigned y, const Vec4& v);
+
+    unsigned width, height;
+    std::vector<double> data;
+  };
+
+  using State = std::map<std::string, Field>;
+
+  /**
+   * One flag per cell, row by row like the fields
+   */
+  using Mask = std::vector<bool>;
+
+  Vec4 bilinear(const Field& f, const double px, const double py);
+  std::array<double, 2> RK(const Field& velocities, const double px, const double py, const double dt);
+
+  Field RKAdvect(const Field& velocities, const Field& field, const double dt);
+  /**
+   * The MacCormack correction and its limiter. The limiter is discontinuous: its result
+   * jumps when a departure point crosses a cell edge (the clamp neighborhood changes) and
+   * when the clamp distance crosses the revert threshold. The cells this close to a jump
+   * for the precision of the fp16 GPU fields are flagged in ambiguous, since the GPU may
+   * land on either side of it. The cells whose backtraces reach a cell already flagged by
+   * an earlier pass of the step are flagged too, their velocities may differ on the GPU.
+   * @param ambiguous the flags of the cells, or nullptr
+   */
+  Field maccormackStep(const Field& field_n, const Field& field_n_1, const Field& field_n_hat, const Field& velocities, const double dt, const double revert,
+    Mask *ambiguous = nullptr);
+  void addSplat(Field& field, const int x, const int y, const std::array<double, 3>& color, const double intensity);
+  void applyBuoyantForce(Field& velocities, const Field& temperature, const Field& density, const double dt, const double kappa, const double sigma, const double t0);
+  Field divergenceCurl(const Field& velocities);
+  void applyVorticity(Field& velocities, const Field& curl, const double dt);
+  void updateQAndTheta(Field& q, Field& theta, const Field& advectedTheta);
+  Field divergenceRB(const Field& velocities);
+  void jacobiRB(const Field& divergence, Field& pressure, const unsigned iterations, const unsigned width, const unsigned height);
+  Field pressureProjectionRB(const Field& pressure, const Field& velocities);
+  Field jacobi(const Field& divergence, const Field& pressure);
+  Field pressureProjection(const Field& pressure, const Field& velocities);
+
+  /**
+   * Mirrors the PressureSolver of the given type, projecting the velocities of the state
+   */
+  void project(State& state, const PressureSolverType solver, const unsigned jacobiIterations);
+
+  /**
+   * Mirrors SimulationFactory::mcAdvect, also returning the intermediate fields
+   * @param ambiguous the flags of the cells where the limiter may jump, see maccormackStep
+   * @return the forward, backward and corrected advections
+   */
+  std::array<Field, 3> mcAdvect(const Field& velocities, const Field& field, const double dt, const double revert, Mask *ambiguous = nullptr);
+
+  /**
+   * The steps of SimpleFluid::Update (without user splats)
+   */
+  void simpleFluidStep(State& state, const double dt, const double revert, const PressureSolverType solver, const unsigned jacobiIterations,
+    Mask *ambiguous = nullptr);
+
+  /**
+   * The steps of Smoke::Update. The random generator must be seeded like the GPU step.
+   */
+  void smokeStep(State& state, const double dt, const double revert, const PressureSolverType solver, const unsigned jacobiIterations,
+    Mask *ambiguous = nullptr);
+
+  /**
+   * The steps of Clouds::Update
+   */
+  void cloudsStep(State& state, const double dt, const double revert, const PressureSolverType solver, const unsigned jacobiIterations,
+    Mask *ambiguous = nullptr);
+}
+
+#endif //REFERENCE_H
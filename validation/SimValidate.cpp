@@ -0,0 +1,380 @@
+#include "ProgramOptions.h"
+#include "GLFWHandler.h"
+#include "Simulations.h"
+#include "Reference.h"
+#include "BenchUtils.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/********** Validation Configuration **********/
+struct ValidationOptions
+{
+  std::vector<SimulationType> simTypes;
+  unsigned width, height;
+  unsigned steps;
+  unsigned seed;
+  unsigned jacobiSweeps;
+  float fixedDt;
+  PressureSolverType pressureSolver;
+  bool activeTiles;
+  Interpolation interpolation;
+  double toleranceInf;
+  double toleranceL2;
+  double toleranceDivergence;
+  double toleranceMasked;
+  std::string store;
+  std::string baseline;
+};
+
+ValidationOptions parseValidationOptions(int argc, char* argv[])
+{
+  namespace po = boost::program_options;
+
+  ValidationOptions options;
+  std::string simTypes, resolution;
+
+  po::options_description po_options("sim_validate [options]");
+  po_options.add_options()
+    ("simTypes", po::value<std::string>(&simTypes)->default_value("splats,smoke,clouds"), "comma separated list of simulations")
+    ("resolution", po::value<std::string>(&resolution)->default_value("512"), "grid size, either N or WxH")
+    ("steps", po::value<unsigned>(&options.steps)->default_value(3), "number of validated steps")
+    ("fixed-dt", po::value<float>(&options.fixedDt)->default_value(0.0f), "time step of every validated step, 0 for the CFL time step of the simulations")
+    ("seed", po::value<unsigned>(&options.seed)->default_value(1), "seed of the random generator")
+    ("pressure-solver", po::value<PressureSolverType>(&options.pressureSolver)->default_value(RED_BLACK), "validated pressure solver (jacobi, red-black, mixed, cpu)")
+    ("jacobi-sweeps", po::value<unsigned>(&options.jacobiSweeps)->default_value(4), "Red-Black iterations per dispatch of the validated solver")
+    ("interpolation", po::value<Interpolation>(&options.interpolation)->default_value(EXACT), "interpolation mode of the validated advection (exact, fast)")
+    ("active-tiles", po::value<bool>(&options.activeTiles)->default_value(false), "validate the dispatches restricted to the active tiles")
+    ("tolerance-inf", po::value<double>(&options.toleranceInf)->default_value(1e-2), "relative L-infinity tolerance per field")
+    ("tolerance-l2", po::value<double>(&options.toleranceL2)->default_value(2e-3), "relative L2 tolerance per field")
+    ("tolerance-div", po::value<double>(&options.toleranceDivergence)->default_value(1e-2), "relative tolerance on the divergence norm")
+    ("tolerance-masked", po::value<double>(&options.toleranceMasked)->default_value(1e-3), "largest fraction of the cells of a field over the L-infinity tolerance where the limiter may jump")
+    ("store", po::value<std::string>(&options.store)->default_value(""), "directory where the final fields are stored")
+    ("baseline", po::value<std::string>(&options.baseline)->default_value(""), "directory of previously stored fields to compare against")
+    ("help,h", "display this message")
+  ;
+
+  try
+  {
+    po::variables_map vm;
+    po::store(po::command_line_parser(argc, argv).options(po_options).run(), vm);
+    po::notify(vm);
+
+    if(vm.count("help"))
+    {
+      std::cout << po_options;
+      std::exit(0);
+    }
+
+    options.simTypes = parseList<SimulationType>(simTypes);
+
+    char separator = 'x';
+    std::stringstream ss(resolution);
+    bool valid = static_cast<bool>(ss >> options.width);
+    options.height = options.width;
+    if(valid && ss >> separator) valid = separator == 'x' && ss >> options.height;
+    if(!valid || options.width < 2 || options.height < 2)
+      throw std::invalid_argument("invalid resolution " + resolution);
+  }
+  catch (std::exception& ex)
+  {
+    std::cout << ex.what() << std::endl;
+    std::cout << po_options;
+    std::exit(1);
+  }
+
+  return options;
+}
+
+/********** Field Comparison **********/
+reference::Field readField(const GLuint tex, const unsigned w, const unsigned h)
+{
+  const std::vector<float> data = readTexture2D(tex, w, h);
+
+  reference::Field f(w, h);
+  std::copy(data.begin(), data.end(), f.data.begin());
+  return f;
+}
+
+reference::State readState(const SimulationBase *sim, const unsigned w, const unsigned h)
+{
+  reference::State state;
+  for(const auto& [name, tex] : sim->Fields())
+    state[name] = readField(tex, w, h);
+
+  return state;
+}
+
+double divergenceNorm(const reference::Field& velocities)
+{
+  const reference::Field div = reference::divergenceCurl(velocities);
+
+  double sum = 0.0;
+  for(std::size_t i = 0; i < div.data.size(); i += 4) sum += div.data[i] * div.data[i];
+  return std::sqrt(sum / (div.width * div.height));
+}
+
+struct Comparison
+{
+  double errorInf, errorL2;
+  std::size_t masked;
+  bool passed;
+};
+
+// Only the channels stored by the texture format are compared, the others read back as (0, 0, 1).
+// The cells where the MacCormack limiter may jump on the GPU are left out of the L-infinity norm.
+// Those over its tolerance are counted as masked, and only a small fraction of the grid may be.
+Comparison compare(const reference::Field& actual, const reference::Field& expected, const ValidationOptions& v,
+    const unsigned channels = 4, const reference::Mask *ambiguous = nullptr)
+{
+  double maxRef = 0.0;
+  for(std::size_t i = 0; i < expected.data.size(); ++i)
+    if(i % 4 < channels) maxRef = std::max(maxRef, std::abs(expected.data[i]));
+
+  // Errors are relative to the field magnitude, but never amplified for small fields
+  const double scale = std::max(1.0, maxRef);
+
+  double maxDiff = 0.0, sumDiff = 0.0;
+  std::size_t masked = 0;
+  for(std::size_t cell = 0; cell < expected.data.size() / 4; ++cell)
+  {
+    double cellDiff = 0.0;
+    for(unsigned k = 0; k < channels; ++k)
+    {
+      const double diff = std::abs(actual.data[4 * cell + k] - expected.data[4 * cell + k]);
+      cellDiff = std::max(cellDiff, diff);
+      sumDiff += diff * diff;
+    }
+
+    if(!ambiguous || !(*ambiguous)[cell]) maxDiff = std::max(maxDiff, cellDiff);
+    else if(cellDiff > v.toleranceInf * scale) ++masked;
+  }
+
+  const std::size_t cells = expected.data.size() / 4;
+  const double rms = std::sqrt(sumDiff / (cells * channels));
+
+  Comparison c;
+  c.errorInf = maxDiff / scale;
+  c.errorL2 = rms / scale;
+  c.masked = masked;
+  c.passed = std::isfinite(sumDiff) && c.errorInf <= v.toleranceInf && c.errorL2 <= v.toleranceL2
+             && masked <= v.toleranceMasked * cells;
+  return c;
+}
+
+// Cells within radius of a flagged cell, through a pass along the rows and one along the columns
+reference::Mask dilate(const reference::Mask& mask, const unsigned w, const unsigned h, const int radius)
+{
+  const int iw = static_cast<int>(w), ih = static_cast<int>(h);
+  reference::Mask rows(mask.size(), false), out(mask.size(), false);
+  for(int y = 0; y < ih; ++y)
+    for(int x = 0; x < iw; ++x)
+      for(int d = -radius; d <= radius && !rows[y * iw + x]; ++d)
+        rows[y * iw + x] = x + d >= 0 && x + d < iw && mask[y * iw + x + d];
+
+  for(int y = 0; y < ih; ++y)
+    for(int x = 0; x < iw; ++x)
+      for(int d = -radius; d <= radius && !out[y * iw + x]; ++d)
+        out[y * iw + x] = y + d >= 0 && y + d < ih && rows[(y + d) * iw + x];
+
+  return out;
+}
+
+/********** Stored Results **********/
+void storeField(const std::string& path, const reference::Field& f)
+{
+  std::ofstream file(path, std::ios::binary);
+  std::vector<float> data(f.data.begin(), f.data.end());
+  file.write(reinterpret_cast<const char*>(&f.width), sizeof(unsigned));
+  file.write(reinterpret_cast<const char*>(&f.height), sizeof(unsigned));
+  file.write(reinterpret_cast<const char*>(data.data()), data.size() * sizeof(float));
+}
+
+bool loadField(const std::string& path, reference::Field& f)
+{
+  std::ifstream file(path, std::ios::binary);
+  if(!file) return false;
+
+  unsigned w, h;
+  file.read(reinterpret_cast<char*>(&w), sizeof(unsigned));
+  file.read(reinterpret_cast<char*>(&h), sizeof(unsigned));
+
+  std::vector<float> data(4 * static_cast<std::size_t>(w) * h);
+  file.read(reinterpret_cast<char*>(data.data()), data.size() * sizeof(float));
+  if(!file) return false;
+
+  f = reference::Field(w, h);
+  std::copy(data.begin(), data.end(), f.data.begin());
+  return true;
+}
+
+/********** Scenarios **********/
+void referenceStep(const ProgramOptions& options, reference::State& state, const double dt, reference::Mask& ambiguous)
+{
+  switch(options.simType)
+  {
+    case SPLATS:
+      reference::simpleFluidStep(state, dt, options.mcRevert, options.pressureSolver, options.jacobiIterations, &ambiguous);
+      break;
+    case SMOKE:
+      reference::smokeStep(state, dt, options.mcRevert, options.pressureSolver, options.jacobiIterations, &ambiguous);
+      break;
+    case CLOUDS:
+      reference::cloudsStep(state, dt, options.mcRevert, options.pressureSolver, options.jacobiIterations, &ambiguous);
+      break;
+  }
+}
+
+bool validate(const ValidationOptions& v, ProgramOptions options)
+{
+  const unsigned w = options.simWidth, h = options.simHeight;
+  bool passed = true;
+
+  std::cout << std::left << std::setw(8) << "sim" << std::setw(6) << "step" << std::setw(16) << "field"
+            << std::setw(14) << "Linf" << std::setw(14) << "L2" << std::setw(8) << "masked" << "status" << std::endl;
+
+  auto report = [&](const std::string& step, const std::string& field, double inf, double l2, std::size_t masked, bool ok)
+  {
+    std::cout << std::left << std::setw(8) << options.simType << std::setw(6) << step << std::setw(16) << field
+              << std::setw(14) << inf << std::setw(14) << l2 << std::setw(8) << masked << (ok ? "ok" : "FAILED") << std::endl;
+    passed = passed && ok;
+  };
+
+  GLFWHandler handler(&options);
+  SimulationBase *sim = createSimulation(&options, &handler);
+  handler.attachSimulation(sim);
+
+  // The CPU solver is also checked against the GPU Red-Black solver it mirrors, stepped
+  // from the same fields with the time step of the validated simulation as its fixed time step
+  ProgramOptions gpuOptions = options;
+  gpuOptions.pressureSolver = RED_BLACK;
+  SimulationBase *gpuSim = nullptr;
+  if(options.pressureSolver == CPU)
+  {
+    gpuSim = createSimulation(&gpuOptions, &handler);
+    gpuSim->Init();
+  }
+
+  // Cells where the limiter may have jumped during any step, moved along by the later steps,
+  // for the comparison of the final fields against the stored ones
+  reference::Mask history(static_cast<std::size_t>(w) * h, false);
+
+  /********** Step by step comparison against the fp64 reference **********/
+  for(unsigned step = 0; step < v.steps; ++step)
+  {
+    reference::State expected = readState(sim, w, h);
+
+    // Through a kernel of the factory, which drops the departure points of the copied fields.
+    // The copies complete before the validated simulation writes its fields again.
+    if(gpuSim)
+    {
+      const std::map<std::string, GLuint> gpuFields = gpuSim->Fields();
+      for(const auto& [name, field] : sim->Fields()) gpuSim->sFact.copy(field, gpuFields.at(name));
+      gpuSim->sFact.flushBarriers();
+    }
+
+    srand(v.seed + step);
+    sim->Update();
+    reference::State actual = readState(sim, w, h);
+
+    srand(v.seed + step);
+    reference::Mask ambiguous(static_cast<std::size_t>(w) * h, false);
+    referenceStep(options, expected, options.dt, ambiguous);
+
+    const std::map<std::string, GLuint> fields = sim->Fields();
+    for(const auto& [name, field] : expected)
+    {
+      Comparison c = compare(actual[name], field, v, textureChannels(fields.at(name)), &ambiguous);
+      report(std::to_string(step), name, c.errorInf, c.errorL2, c.masked, c.passed);
+    }
+
+    // A step moves the cells by up to dt |v| through both advection passes (see maccormackStep)
+    const std::vector<double>& velocities = expected["velocities"].data;
+    double vMax = 0.0;
+    for(std::size_t i = 0; i < velocities.size(); ++i) if(i % 4 < 2) vMax = std::max(vMax, std::abs(velocities[i]));
+    history = dilate(history, w, h, static_cast<int>(std::ceil(2.0 * options.dt * vMax)) + 2);
+    for(std::size_t cell = 0; cell < history.size(); ++cell) history[cell] = history[cell] || ambiguous[cell];
+
+    if(gpuSim)
+    {
+      srand(v.seed + step);
+      gpuOptions.dt = gpuOptions.fixedDt = options.dt;
+      gpuSim->Update();
+      reference::State gpu = readState(gpuSim, w, h);
+
+      for(const auto& [name, field] : gpu)
+      {
+        Comparison c = compare(actual[name], field, v, textureChannels(fields.at(name)), &ambiguous);
+        report(std::to_string(step), "gpu " + name, c.errorInf, c.errorL2, c.masked, c.passed);
+      }
+    }
+
+    const double divActual = divergenceNorm(actual["velocities"]);
+    const double divExpected = divergenceNorm(expected["velocities"]);
+    const double divError = std::abs(divActual - divExpected) / std::max(divExpected, 1e-3);
+    report(std::to_string(step), "divergence", divActual, divExpected, 0, divError <= v.toleranceDivergence);
+  }
+
+  /********** Comparison against stored results **********/
+  reference::State final = readState(sim, w, h);
+  for(const auto& [name, field] : final)
+  {
+    std::stringstream prefix;
+    prefix << options.simType << "_" << w << "x" << h << "_" << name << ".bin";
+
+    if(!v.store.empty()) storeField(v.store + "/" + prefix.str(), field);
+
+    if(!v.baseline.empty())
+    {
+      reference::Field stored;
+      if(!loadField(v.baseline + "/" + prefix.str(), stored))
+      {
+        report("base", name, 0.0, 0.0, 0, false);
+        continue;
+      }
+
+      Comparison c = compare(field, stored, v, textureChannels(sim->Fields().at(name)), &history);
+      report("base", name, c.errorInf, c.errorL2, c.masked, c.passed);
+    }
+  }
+
+  delete gpuSim;
+  delete sim;
+
+  return passed;
+}
+
+int main(int argc, char** argv)
+{
+  ValidationOptions v = parseValidationOptions(argc, argv);
+
+  ProgramOptions defaults = offscreenOptions("sim_validate");
+  defaults.simWidth = v.width;
+  defaults.simHeight = v.height;
+  defaults.jacobiSweeps = v.jacobiSweeps;
+  defaults.pressureSolver = v.pressureSolver;
+  defaults.activeTiles = v.activeTiles;
+  defaults.interpolation = v.interpolation;
+  defaults.fixedDt = v.fixedDt;
+  if(v.fixedDt > 0.0f) defaults.dt = v.fixedDt;
+
+  bool passed = true;
+  for(SimulationType simType : v.simTypes)
+  {
+    ProgramOptions options = defaults;
+    options.simType = simType;
+    passed = validate(v, options) && passed;
+  }
+
+  std::cout << (passed ? "All fields within tolerances" : "Validation FAILED") << std::endl;
+
+  return passed ? 0 : 1;
+}